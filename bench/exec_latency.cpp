@@ -0,0 +1,231 @@
+#include <err.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../src/common.hpp"
+#include "../src/ipc/binary.hpp"
+#include "../src/ipc/commands.hpp"
+
+extern char** environ;
+
+/// Measures how long a key binding waits for `waitron`: from spawning it to
+/// reading its reply, and to its exit. It runs the given command against the
+/// live windowchef, the same way a hotkey daemon does.
+///
+/// With `-b`, it measures the round trip of binary requests over one
+/// connection instead, and checks the header of every response, so the
+/// framing in `binary.hpp` stays in sync with the server.
+namespace bench {
+
+  using Clock = std::chrono::steady_clock;
+
+  struct Sample {
+    /// Until the first byte of the reply, or the exit if there is none
+    long reply_us;
+    long exit_us;
+  };
+
+  long micros(Clock::duration duration)
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+  }
+
+  Sample run_once(char** argv)
+  {
+    int out[2];
+    if (pipe2(out, O_CLOEXEC) != 0) {
+      errx(EXIT_FAILURE, "Error creating pipe: %s", strerror(errno));
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+
+    auto start = Clock::now();
+    pid_t pid;
+    int res = posix_spawnp(&pid, argv[0], &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out[1]);
+    if (res != 0) {
+      errx(EXIT_FAILURE, "Error running %s: %s", argv[0], strerror(res));
+    }
+
+    std::optional<Clock::time_point> reply;
+    char buffer[4096];
+    ssize_t len;
+    while ((len = read(out[0], buffer, sizeof(buffer))) != 0) {
+      if (len < 0 && errno == EINTR) continue;
+      if (len < 0) errx(EXIT_FAILURE, "Error reading: %s", strerror(errno));
+      if (!reply) reply = Clock::now();
+    }
+    close(out[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    auto end = Clock::now();
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      errx(EXIT_FAILURE, "%s failed, is windowchef running?", argv[0]);
+    }
+    return {micros(reply.value_or(end) - start), micros(end - start)};
+  }
+
+  int connect_socket()
+  {
+    sockaddr_un addr;
+    auto addr_len = socket_address(addr);
+    int fd        = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr*) &addr, addr_len) != 0) {
+      errx(EXIT_FAILURE, "Error connecting: %s, is windowchef running?",
+           strerror(errno));
+    }
+    return fd;
+  }
+
+  /// A `get_focused` request in binary framing, tagged with `seq`
+  std::string binary_request(std::uint32_t seq)
+  {
+    using namespace ipc::binary;
+    std::string req;
+    write_le<std::uint8_t>(req, magic);
+    write_le<std::uint8_t>(req, Seq);
+    write_le<std::uint16_t>(req, std::uint16_t(ipc::Command::GetFocused));
+    write_le<std::uint32_t>(req, seq);
+    write_le<std::uint32_t>(req, std::uint32_t(getpid()));
+    // No arguments
+    write_le<std::uint8_t>(req, 0);
+    if (req.size() != request_header_size) {
+      errx(EXIT_FAILURE, "Binary request header has %zu bytes, not %zu",
+           req.size(), request_header_size);
+    }
+    return req;
+  }
+
+  /// Send a binary request on `fd`, and check the header of the response
+  ///
+  /// \returns the time until the response arrived
+  long binary_once(int fd, std::uint32_t seq)
+  {
+    using namespace ipc::binary;
+    auto req = binary_request(seq);
+    char res[4096];
+
+    auto start = Clock::now();
+    if (send(fd, req.data(), req.size(), MSG_NOSIGNAL) != ssize_t(req.size())) {
+      errx(EXIT_FAILURE, "Error sending: %s", strerror(errno));
+    }
+    ssize_t len;
+    while ((len = recv(fd, res, sizeof(res), 0)) < 0 && errno == EINTR) {}
+    auto end = Clock::now();
+
+    if (len < ssize_t(response_header_size)) {
+      errx(EXIT_FAILURE, "Response of %zd bytes is shorter than its header",
+           len);
+    }
+    if (std::uint8_t(res[0]) != magic) {
+      errx(EXIT_FAILURE, "Response doesn't start with the binary magic");
+    }
+    if (read_le<std::uint8_t>(res + 1) != std::uint8_t(Status::Ok)) {
+      errx(EXIT_FAILURE, "get_focused failed: %.*s",
+           int(len - response_header_size), res + response_header_size);
+    }
+    if (auto got = read_le<std::uint32_t>(res + 2); got != seq) {
+      errx(EXIT_FAILURE, "Response has sequence id %u, not %u", got, seq);
+    }
+    return micros(end - start);
+  }
+
+  /// Nearest rank percentile of sorted `values`
+  long percentile(std::vector<long> const& values, double p)
+  {
+    auto rank = static_cast<std::size_t>(p * values.size() + 0.999999);
+    return values[std::clamp<std::size_t>(rank, 1, values.size()) - 1];
+  }
+
+  void report(const char* name, std::vector<long> values)
+  {
+    std::sort(values.begin(), values.end());
+    printf("%-6s %8ld %8ld %8ld %8ld\n", name, values.front(),
+           percentile(values, 0.5), percentile(values, 0.99), values.back());
+  }
+
+  void usage(char* name)
+  {
+    fprintf(stderr,
+            "Usage: %s [-n runs] [-w warmup] [<client> [<args>...]]\n"
+            "       %s -b [-n runs] [-w warmup]\n"
+            "Without a client, runs ./waitron get_focused\n"
+            "With -b, sends get_focused in binary framing over one "
+            "connection\n",
+            name, name);
+    exit(EXIT_FAILURE);
+  }
+
+} // namespace bench
+
+using namespace bench;
+
+int main(int argc, char** argv)
+{
+  int runs = 1000, warmup = 50;
+  bool binary = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "+hbn:w:")) != -1) {
+    switch (opt) {
+    case 'b': binary = true; break;
+    case 'n': runs = atoi(optarg); break;
+    case 'w': warmup = atoi(optarg); break;
+    default: usage(argv[0]); break;
+    }
+  }
+  if (runs < 1 || (binary && optind < argc)) usage(argv[0]);
+
+  if (binary) {
+    int fd            = connect_socket();
+    std::uint32_t seq = 0;
+    for (int i = 0; i < warmup; i++) binary_once(fd, ++seq);
+    std::vector<long> reply_us;
+    reply_us.reserve(runs);
+    for (int i = 0; i < runs; i++) reply_us.push_back(binary_once(fd, ++seq));
+    close(fd);
+
+    printf("%d binary get_focused round trips\n", runs);
+    printf("%-6s %8s %8s %8s %8s\n", "us", "min", "p50", "p99", "max");
+    report("reply", std::move(reply_us));
+    return 0;
+  }
+
+  static char waitron[] = "./waitron", command[] = "get_focused";
+  char* default_argv[]  = {waitron, command, nullptr};
+  char** client         = optind < argc ? argv + optind : default_argv;
+
+  for (int i = 0; i < warmup; i++) run_once(client);
+
+  std::vector<long> reply_us, exit_us;
+  reply_us.reserve(runs);
+  exit_us.reserve(runs);
+  for (int i = 0; i < runs; i++) {
+    auto sample = run_once(client);
+    reply_us.push_back(sample.reply_us);
+    exit_us.push_back(sample.exit_us);
+  }
+
+  printf("%d runs of", runs);
+  for (char** arg = client; *arg != nullptr; arg++) printf(" %s", *arg);
+  printf("\n%-6s %8s %8s %8s %8s\n", "us", "min", "p50", "p99", "max");
+  report("reply", std::move(reply_us));
+  report("exit", std::move(exit_us));
+}
@@ -11,3 +11,5 @@ DOCPREFIX = $(PREFIX)/share/doc
 
 CFLAGS += -std=c99 -Wall -Wextra -O2
 LDFLAGS += -lm -lxcb -lxcb-ewmh -lxcb-icccm -lxcb-randr -lxcb-keysyms -lpthread
+# waitron starts on every key binding, so it only loads what it uses
+CLIENT_LDFLAGS += -lxcb
@@ -1,29 +1,109 @@
 #include <err.h>
+#include <algorithm>
+#include <getopt.h>
+#include <cctype>
 #include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
-#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <xcb/xcb.h>
+
 #include "common.hpp"
+#include "state.hpp"
 
+/// The client is exec'd for every key binding, so it sticks to plain
+/// POSIX I/O: no iostreams, and nothing to initialize before `main`.
 namespace client {
 
-  void send_fifo(int argc, char** argv)
+  enum struct Transport { Socket, Fifo, X11 };
+
+  /// Views of `argv`, or of the line being sent in batch mode
+  using Command = std::vector<std::string_view>;
+
+  /// If false, requests are sent with the `noreply` flag, and waitron exits
+  /// right after sending them.
+  bool get_response = true;
+
+  /// Write all of `data` to `fd`
+  void write_all(int fd, std::string_view data)
+  {
+    while (!data.empty()) {
+      auto res = write(fd, data.data(), data.size());
+      if (res < 0 && errno == EINTR) continue;
+      if (res < 0) {
+        errx(EXIT_FAILURE, "Error writing: %s", strerror(errno));
+      }
+      data.remove_prefix(res);
+    }
+  }
+
+  void print(std::string_view str)
+  {
+    write_all(STDOUT_FILENO, str);
+  }
+
+  /// Serialize a request in the wire format:
+  /// `pid[,noreply][,seq=N]:command\targ\t...\n`
+  std::string make_request(Command const& command,
+                           std::optional<unsigned long> seq = std::nullopt)
+  {
+    std::string res = std::to_string(getpid());
+    if (!get_response) res += ",noreply";
+    if (seq) {
+      res += ",seq=";
+      res += std::to_string(*seq);
+    }
+    res += ':';
+    for (auto& arg : command) {
+      res += arg;
+      res += '\t';
+    }
+    res += '\n';
+    return res;
+  }
+
+  /// Split a line of a batch file into a command and its arguments.
+  ///
+  /// Arguments are separated by whitespace. Everything after a `#` is a
+  /// comment.
+  Command split_command(std::string_view line)
+  {
+    Command res;
+    line = line.substr(0, line.find('#'));
+    auto is_space = [](char c) { return std::isspace((unsigned char) c) != 0; };
+    auto iter     = line.begin();
+    while (true) {
+      iter = std::find_if_not(iter, line.end(), is_space);
+      if (iter == line.end()) break;
+      auto end = std::find_if(iter, line.end(), is_space);
+      res.emplace_back(&*iter, end - iter);
+      iter = end;
+    }
+    return res;
+  }
+
+  void send_fifo(Command const& command)
   {
-    bool get_response = true;
     // Multiple writers to one fifo is guarantied to not be interleaved if the
     // messages are < PIPE_BUF, which is at least 512. On OSX and some BSD systems
     // it's 512, on linux it's 4096. Either way, it shouldn't be an issue, as
     // practically all messages are shorter.
     auto name = request_fifo_name();
 
-    errno = 0;
-    auto stream = std::ofstream(name);
-    if (!stream.is_open()) {
+    int fd = open(name.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
         errx(EXIT_FAILURE, "Error opening request pipe: %s", strerror(errno));
     }
 
@@ -35,39 +115,361 @@ namespace client {
       }
     }
 
-    stream << getpid() << ":";
-    for (int i = 1; i < argc; i++) {
-      stream << argv[i] << '\t';
-    }
-    stream << '\n';
-    stream.close();
+    write_all(fd, make_request(command));
+    close(fd);
 
     if (get_response) {
-      auto resp_name = response_fifo_name();
-      errno = 0;
-      auto stream = std::ifstream(resp_name);
-      if (errno != 0) {
+      fd = open(resp_name.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
         remove(resp_name.c_str());
         errx(EXIT_FAILURE, "Error opening response pipe: %s", strerror(errno));
       }
-      char buffer[512];
-      while (stream.good()) {
-        stream.read(buffer, 512);
-        std::cout << buffer;
-      }
-      std::cout << std::endl;
-      if (errno != 0) {
-        remove(resp_name.c_str());
-        errx(EXIT_FAILURE, "Error reading response from pipe: %s", strerror(errno));
+      char buffer[4096];
+      ssize_t len;
+      while ((len = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (len < 0 && errno == EINTR) continue;
+        if (len < 0) {
+          remove(resp_name.c_str());
+          errx(EXIT_FAILURE, "Error reading response from pipe: %s",
+               strerror(errno));
+        }
+        print(std::string_view(buffer, len));
       }
+      close(fd);
       remove(resp_name.c_str());
     }
   }
+
+  int connect_socket()
+  {
+    sockaddr_un addr;
+    auto addr_len = socket_address(addr);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      errx(EXIT_FAILURE, "Error creating socket: %s", strerror(errno));
+    }
+    if (connect(fd, (sockaddr*) &addr, addr_len) != 0) {
+      errx(EXIT_FAILURE, "Error connecting to %s: %s", __NAME__,
+           strerror(errno));
+    }
+    return fd;
+  }
+
+  /// Send a request on a connected socket, without waiting for a response.
+  void socket_send(int fd, std::string const& request)
+  {
+    if (send(fd, request.data(), request.size(), 0) < 0) {
+      errx(EXIT_FAILURE, "Error sending request: %s", strerror(errno));
+    }
+  }
+
+  /// Recieve one response from a connected socket.
+  ///
+  /// \returns `std::nullopt` if `flags` contains `MSG_DONTWAIT` and no
+  /// response is ready.
+  std::optional<std::string> socket_recv(int fd, int flags = 0)
+  {
+    // Peek first, to find out how big the response is
+    auto len = recv(fd, nullptr, 0, MSG_PEEK | MSG_TRUNC | flags);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return std::nullopt;
+    }
+    if (len <= 0) {
+      errx(EXIT_FAILURE, "Error reading response: %s",
+           len == 0 ? "connection closed" : strerror(errno));
+    }
+    std::string response(len, '\0');
+    recv(fd, response.data(), response.size(), 0);
+    return response;
+  }
+
+  /// Send a request on a connected socket, and wait for the response.
+  std::string socket_roundtrip(int fd, std::string const& request)
+  {
+    socket_send(fd, request);
+    return *socket_recv(fd);
+  }
+
+  void send_socket(Command const& command)
+  {
+    int fd = connect_socket();
+    if (get_response) {
+      auto response = socket_roundtrip(fd, make_request(command));
+      print(response);
+      // Print events until windowchef goes away
+      if (command[0] == "subscribe" && response.rfind("Error: ", 0) != 0) {
+        while (true) {
+          print(*socket_recv(fd));
+        }
+      }
+    } else {
+      socket_send(fd, make_request(command));
+    }
+    close(fd);
+  }
+
+  static xcb_atom_t intern_atom(xcb_connection_t* conn, const char* name)
+  {
+    auto* reply = xcb_intern_atom_reply(
+      conn, xcb_intern_atom(conn, 0, strlen(name), name), nullptr);
+    if (reply == nullptr) {
+      errx(EXIT_FAILURE, "Error interning atom %s", name);
+    }
+    auto atom = reply->atom;
+    free(reply);
+    return atom;
+  }
+
+  /// Send the request as a client message on the root window.
+  ///
+  /// The request is stored in a property of a private window, which also
+  /// recieves the response in another property.
+  void send_x(Command const& command)
+  {
+    int scrno;
+    auto* conn = xcb_connect(nullptr, &scrno);
+    if (xcb_connection_has_error(conn) != 0) {
+      errx(EXIT_FAILURE, "Error connecting to X");
+    }
+    auto* scr = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+
+    auto command_atom  = intern_atom(conn, IPC_COMMAND_ATOM);
+    auto response_atom = intern_atom(conn, IPC_RESPONSE_ATOM);
+
+    xcb_window_t win  = xcb_generate_id(conn);
+    uint32_t values[] = {XCB_EVENT_MASK_PROPERTY_CHANGE};
+    xcb_create_window(conn, XCB_COPY_FROM_PARENT, win, scr->root, 0, 0, 1, 1,
+                      0, XCB_WINDOW_CLASS_INPUT_ONLY, XCB_COPY_FROM_PARENT,
+                      XCB_CW_EVENT_MASK, values);
+
+    auto request = make_request(command);
+    xcb_change_property(conn, XCB_PROP_MODE_REPLACE, win, command_atom,
+                        XCB_ATOM_STRING, 8, request.size(), request.data());
+
+    xcb_client_message_event_t ev = {};
+    ev.response_type  = XCB_CLIENT_MESSAGE;
+    ev.format         = 32;
+    ev.window         = win;
+    ev.type           = command_atom;
+    ev.data.data32[0] = win;
+    xcb_send_event(conn, 0, scr->root,
+                   XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
+                     XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY,
+                   (char*) &ev);
+    xcb_flush(conn);
+
+    // The window, and the request with it, is destroyed when we disconnect.
+    // Without a response, wait until the WM has taken the request, which
+    // deletes the property.
+    auto wait_atom  = get_response ? response_atom : command_atom;
+    auto wait_state = get_response ? XCB_PROPERTY_NEW_VALUE : XCB_PROPERTY_DELETE;
+
+    xcb_generic_event_t* event;
+    while ((event = xcb_wait_for_event(conn)) != nullptr) {
+      auto* e = (xcb_property_notify_event_t*) event;
+      bool done = (event->response_type & ~0x80) == XCB_PROPERTY_NOTIFY &&
+                  e->atom == wait_atom && e->state == wait_state;
+      free(event);
+      if (done) break;
+    }
+    if (event == nullptr) {
+      errx(EXIT_FAILURE, "Lost connection to X");
+    }
+    if (!get_response) {
+      xcb_disconnect(conn);
+      return;
+    }
+
+    auto* reply = xcb_get_property_reply(
+      conn,
+      xcb_get_property(conn, 1, win, response_atom, XCB_ATOM_STRING, 0, 1 << 14),
+      nullptr);
+    if (reply != nullptr) {
+      print(std::string_view(static_cast<char*>(xcb_get_property_value(reply)),
+                             xcb_get_property_value_length(reply)));
+      free(reply);
+    }
+    xcb_disconnect(conn);
+  }
+
+  /// Pipeline requests on one socket connection.
+  ///
+  /// Every request is tagged with a sequence id, so requests can be sent
+  /// without waiting for the responses to the previous ones. Responses are
+  /// printed in the order of the requests.
+  struct Pipeline {
+    int fd = connect_socket();
+    unsigned long next_seq   = 0;
+    unsigned long next_print = 0;
+    /// Responses that can't be printed yet, by sequence id
+    std::map<unsigned long, std::string> pending;
+
+    ~Pipeline()
+    {
+      close(fd);
+    }
+
+    void send(Command const& command)
+    {
+      if (!get_response) {
+        socket_send(fd, make_request(command));
+        return;
+      }
+      socket_send(fd, make_request(command, next_seq++));
+      // Print what has arrived so far, without blocking
+      while (receive(MSG_DONTWAIT)) {}
+    }
+
+    /// Wait for all outstanding responses
+    void finish()
+    {
+      while (next_print < next_seq) receive(0);
+    }
+
+    bool receive(int flags)
+    {
+      auto response = socket_recv(fd, flags);
+      if (!response) return false;
+      // A response without a sequence id answers no request in particular,
+      // like the error for a header that couldn't be parsed
+      auto colon = response->find(':');
+      char* end  = nullptr;
+      auto seq   = strtoul(response->c_str(), &end, 10);
+      if (colon == std::string::npos || colon == 0 ||
+          end != response->c_str() + colon) {
+        errx(EXIT_FAILURE, "Connection error: %s", response->c_str());
+      }
+      pending[seq] = response->substr(colon + 1);
+
+      for (auto iter = pending.begin();
+           iter != pending.end() && iter->first == next_print;
+           iter = pending.erase(iter), next_print++) {
+        print(iter->second);
+      }
+      return true;
+    }
+  };
+
+  /// Send one command per line of `file`.
+  ///
+  /// On the socket, all commands are pipelined on one connection, and the
+  /// responses are printed in order.
+  void send_batch(FILE* file, Transport transport)
+  {
+    std::optional<Pipeline> pipeline;
+    if (transport == Transport::Socket) pipeline.emplace();
+
+    char* line = nullptr;
+    std::size_t capacity = 0;
+    ssize_t len;
+    while ((len = getline(&line, &capacity, file)) >= 0) {
+      auto command = split_command(std::string_view(line, len));
+      if (command.empty()) continue;
+      switch (transport) {
+      case Transport::Socket: pipeline->send(command); break;
+      case Transport::Fifo: send_fifo(command); break;
+      case Transport::X11: send_x(command); break;
+      }
+    }
+    free(line);
+    if (pipeline) pipeline->finish();
+  }
+
+  /// Print the state snapshot published by the WM in shared memory.
+  ///
+  /// Workspaces are numbered from 1, like in `workspace_goto`.
+  void print_state()
+  {
+    state::Reader reader;
+    if (!reader.open()) {
+      errx(EXIT_FAILURE, "Error opening the shared state of %s", __NAME__);
+    }
+    auto snap = *reader.read();
+    printf("focused_window\t%u\ncurrent_workspace\t%u\nbar_shown\t%d\n",
+           unsigned(snap.focused_window), unsigned(snap.current_workspace + 1),
+           int(snap.bar_shown));
+    auto count = std::min(snap.workspace_count, state::max_workspaces);
+    for (std::uint32_t i = 0; i < count; i++) {
+      printf("workspace\t%u\t%u\t%d\n", unsigned(i + 1),
+             unsigned(snap.window_count[i]), int(snap.workspace_bar_shown[i]));
+    }
+  }
+
+  void usage(char* name)
+  {
+    fprintf(stderr,
+            "Usage: %s [-h|-v|-f|-x|-n] <command> [<args>...]\n"
+            "       %s [-f|-x|-n] (-|-b FILE)\n"
+            "       %s -s\n",
+            name, name, name);
+    exit(EXIT_SUCCESS);
+  }
+
+  void version()
+  {
+    fprintf(stderr, "%s %s\n", __NAME_CLIENT__, __THIS_VERSION__);
+    exit(EXIT_SUCCESS);
+  }
 } // namespace
 
 using namespace client;
 
 int main(int argc, char** argv)
 {
-  send_fifo(argc, argv);
+  static const option long_options[] = {
+    {"help", no_argument, nullptr, 'h'},
+    {"version", no_argument, nullptr, 'v'},
+    {"fifo", no_argument, nullptr, 'f'},
+    {"x11", no_argument, nullptr, 'x'},
+    {"batch", required_argument, nullptr, 'b'},
+    {"no-reply", no_argument, nullptr, 'n'},
+    {"state", no_argument, nullptr, 's'},
+    {nullptr, 0, nullptr, 0},
+  };
+
+  auto transport    = Transport::Socket;
+  const char* batch = nullptr;
+  int opt;
+  // '+' stops at the first command argument, so negative numbers are
+  // not taken for options
+  while ((opt = getopt_long(argc, argv, "+hvfxnsb:", long_options, nullptr)) !=
+         -1) {
+    switch (opt) {
+    case 'h': usage(argv[0]); break;
+    case 'v': version(); break;
+    case 'f': transport = Transport::Fifo; break;
+    case 'x': transport = Transport::X11; break;
+    case 'b': batch = optarg; break;
+    case 'n': get_response = false; break;
+    case 's': print_state(); return 0;
+    default: usage(argv[0]); break;
+    }
+  }
+  if (batch == nullptr && optind < argc && strcmp(argv[optind], "-") == 0) {
+    batch = "-";
+  }
+
+  if (batch != nullptr) {
+    if (strcmp(batch, "-") == 0) {
+      send_batch(stdin, transport);
+    } else {
+      auto* file = fopen(batch, "re");
+      if (file == nullptr) {
+        errx(EXIT_FAILURE, "Error opening %s: %s", batch, strerror(errno));
+      }
+      send_batch(file, transport);
+      fclose(file);
+    }
+    return 0;
+  }
+
+  if (optind >= argc) usage(argv[0]);
+
+  auto command = Command(argv + optind, argv + argc);
+  switch (transport) {
+  case Transport::Socket: send_socket(command); break;
+  case Transport::Fifo: send_fifo(command); break;
+  case Transport::X11: send_x(command); break;
+  }
 }
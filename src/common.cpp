@@ -1,27 +1,66 @@
-#include <sstream>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 
 #include "common.hpp"
 
 #include <xcb/xcb_util.h>
 #include <unistd.h>
 
-std::string request_fifo_name()
+/// Identifies the display we are running on, like `host-display-screen`
+static std::string display_name()
 {
-  char* host;
-  int display, screen;
+  char* host = nullptr;
+  int display = 0, screen = 0;
   xcb_parse_display(nullptr, &host, &display, &screen);
 
-  std::ostringstream stream;
-  stream << "/tmp/" << __NAME__ << "-" << host << "-" << display << "-" << screen << ".fifo";
-  return stream.str();
+  std::string res = host != nullptr ? host : "";
+  free(host);
+  res += '-';
+  res += std::to_string(display);
+  res += '-';
+  res += std::to_string(screen);
+  return res;
+}
+
+std::string request_fifo_name()
+{
+  return "/tmp/" __NAME__ "-" + display_name() + ".fifo";
 }
 
 std::string response_fifo_name(__pid_t pid)
 {
-  char* host;
-  int display, screen;
+  return "/tmp/" __NAME__ "-response-" + std::to_string(pid) + ".fifo";
+}
 
-  std::ostringstream stream;
-  stream << "/tmp/" << __NAME__ << "-response-" << pid << ".fifo";
-  return stream.str();
+std::string socket_name()
+{
+  // Also spares clients from parsing $DISPLAY
+  if (const char* env = getenv(IPC_SOCKET_ENV); env != nullptr && *env != '\0') {
+    std::string res = env;
+    if (res[0] == '@') res[0] = '\0';
+    return res;
+  }
+#ifdef __linux__
+  return std::string(1, '\0') + __NAME__ "-" + display_name();
+#else
+  return "/tmp/" __NAME__ "-" + display_name() + ".sock";
+#endif
+}
+
+std::string shm_name()
+{
+  return "/" __NAME__ "-" + display_name();
+}
+
+socklen_t socket_address(sockaddr_un& addr)
+{
+  auto name = socket_name();
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  auto len = std::min(name.size(), sizeof(addr.sun_path) - 1);
+  std::memcpy(addr.sun_path, name.data(), len);
+  return offsetof(sockaddr_un, sun_path) + len;
 }
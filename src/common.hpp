@@ -3,11 +3,15 @@
  * full license information. */
 #pragma once
 
-#ifdef D
-#define DMSG(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
-#else
-#define DMSG(fmt, ...)
-#endif
+#include "log.hpp"
+
+/* debug messages, shown when the log level is debug, which is the default
+ * when built with -DD */
+#define DMSG(fmt, ...)                                                    \
+  do {                                                                    \
+    if (logging::enabled(logging::Level::Debug))                          \
+      logging::printf(logging::Level::Debug, fmt, ##__VA_ARGS__);         \
+  } while (0)
 
 #ifndef __NAME__
 #define __NAME__ "wm"
@@ -27,8 +31,32 @@
 
 #define MAXLEN 256
 
+/* atoms used to send commands as client messages, and to return responses */
+#define IPC_COMMAND_ATOM "WINDOWCHEF_COMMAND"
+#define IPC_RESPONSE_ATOM "WINDOWCHEF_RESPONSE"
+/* environment variable overriding the socket name. A leading @ stands for
+ * the abstract namespace */
+#define IPC_SOCKET_ENV "WINDOWCHEF_SOCKET"
+
 #include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 std::string request_fifo_name();
 std::string response_fifo_name(__pid_t pid = getpid());
+
+/// Name of the IPC socket, from `$WINDOWCHEF_SOCKET` if it is set.
+///
+/// On linux, the socket lives in the abstract namespace, and the name starts
+/// with a null byte.
+std::string socket_name();
+
+/// Name of the shared memory object holding the state snapshot, for
+/// `shm_open`. See `state.hpp`.
+std::string shm_name();
+
+/// Fill `addr` with the address of the IPC socket.
+///
+/// \returns the length of the address, to be passed to `bind` or `connect`
+socklen_t socket_address(sockaddr_un& addr);
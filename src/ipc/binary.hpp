@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+/// Binary framing of requests and responses.
+///
+/// An alternative to the text format, for programs sending commands at a
+/// high rate. Numbers are little endian.
+///
+/// Request:
+///
+/// | size | field                                   |
+/// |------|-----------------------------------------|
+/// | 1    | `magic`                                 |
+/// | 1    | flags, see `Flags`                      |
+/// | 2    | command, the value of `ipc::Command`    |
+/// | 4    | sequence id, if `Flags::Seq` is set     |
+/// | 4    | pid of the client                       |
+/// | 1    | number of arguments                     |
+///
+/// Followed by the arguments, each a type byte (see `ArgType`) and either an
+/// `int64` or a `uint16` length and that many bytes of string.
+///
+/// Response:
+///
+/// | size | field                 |
+/// |------|-----------------------|
+/// | 1    | `magic`               |
+/// | 1    | status, see `Status`  |
+/// | 4    | sequence id           |
+///
+/// Followed by the response text, or the error message.
+namespace ipc::binary {
+
+  /// First byte of every binary frame. Text requests start with a digit.
+  constexpr std::uint8_t magic = 0xC5;
+
+  enum Flags : std::uint8_t {
+    NoReply = 1 << 0,
+    Seq     = 1 << 1,
+    /// The first argument is a selector, see `ipc::Selector`
+    Select  = 1 << 2,
+  };
+
+  enum struct ArgType : std::uint8_t {
+    Int    = 0,
+    String = 1,
+  };
+
+  enum struct Status : std::uint8_t {
+    Ok    = 0,
+    Error = 1,
+    /// An event streamed to a subscriber
+    Event = 2,
+  };
+
+  constexpr std::size_t request_header_size  = 13;
+  constexpr std::size_t response_header_size = 6;
+
+  /// Read a little endian integer. `data` must hold `sizeof(T)` bytes
+  template<typename T>
+  T read_le(const char* data) noexcept
+  {
+    std::make_unsigned_t<T> res = 0;
+    for (std::size_t i = 0; i < sizeof(T); i++) {
+      res |= std::make_unsigned_t<T>(std::uint8_t(data[i])) << (8 * i);
+    }
+    return static_cast<T>(res);
+  }
+
+  /// Append a little endian integer to `out`
+  template<typename T>
+  void write_le(std::string& out, T value)
+  {
+    auto bits = static_cast<std::make_unsigned_t<T>>(value);
+    for (std::size_t i = 0; i < sizeof(T); i++) {
+      out += static_cast<char>((bits >> (8 * i)) & 0xff);
+    }
+  }
+
+} // namespace ipc::binary
@@ -35,6 +35,18 @@ namespace ipc {
     WMConfig,
     WindowConfig,
     GetFocused,
+    Subscribe,
+    WaitFor,
+    After,
+    Every,
+    Cancel,
+    DefineMacro,
+    RunMacro,
+    GetTree,
+    Begin,
+    Commit,
+    ListCommands,
+    LogLevel,
     Number
   };
 
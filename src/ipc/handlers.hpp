@@ -25,43 +25,113 @@
 
 namespace ipc {
 
+  /// Set while a command runs for each window of a selector
+  static Client* selected = nullptr;
+
+  /// The window a window command acts on: the selected one, or else the
+  /// focused one
+  Client* target()
+  {
+    return selected != nullptr ? selected : wm::focused_client();
+  }
+
+  /// Focus a window again after changing its geometry. Selected windows only
+  /// get their borders redrawn, so a selector doesn't move the focus.
+  void refocus(Client& client)
+  {
+    if (selected != nullptr) {
+      wm::refresh_borders(client);
+    } else {
+      wm::set_focused(client);
+    }
+  }
+
+  /// Whether a command acts on `target()`, and so can take a selector
+  bool takes_selector(Command cmd)
+  {
+    switch (cmd) {
+    case Command::WindowMove:
+    case Command::WindowMoveAbsolute:
+    case Command::WindowResize:
+    case Command::WindowResizeAbsolute:
+    case Command::WindowMaximize:
+    case Command::WindowUnmaximize:
+    case Command::WindowHorMaximize:
+    case Command::WindowVerMaximize:
+    case Command::WindowClose:
+    case Command::WindowPutInGrid:
+    case Command::WindowSnap:
+    case Command::WindowCardinalMove:
+    case Command::WindowCardinalGrow:
+    case Command::WindowCardinalShrink:
+    case Command::WorkspaceAddWindow: return true;
+    default: return false;
+    }
+  }
+
+  /// The windows matching a selector
+  std::vector<xcb_window_t> select(Selector const& sel)
+  {
+    std::vector<xcb_window_t> res;
+    auto window = sel.kind == Selector::UnderPointer
+                    ? xcb::get_window_under_pointer()
+                    : sel.window;
+    for (auto& ws : wm::workspaces()) {
+      if (sel.kind == Selector::Workspace && ws.index != sel.workspace) {
+        continue;
+      }
+      for (auto& cl : ws.windows) {
+        bool match = false;
+        switch (sel.kind) {
+        case Selector::Id:
+        case Selector::UnderPointer: match = cl.window == window; break;
+        case Selector::Class:
+          match = cl.class_name == sel.window_class ||
+                  cl.instance_name == sel.window_class;
+          break;
+        case Selector::Workspace:
+        case Selector::All: match = true; break;
+        case Selector::Mapped: match = cl.mapped; break;
+        }
+        if (match) res.push_back(cl.window);
+      }
+    }
+    return res;
+  }
+
   void handler(For<Command::Number>, Args)
   {
     throw std::runtime_error("");
   }
 
-  void handler(For<Command::WindowMove>, Args args)
+  void handler(For<Command::WindowMove>, int x, int y)
   {
-    auto [x, y] = args.parse<int, int>();
-
-    if (wm::focused_client() == nullptr) {
+    if (target() == nullptr) {
       return;
     }
-    Client& focused = *wm::focused_client();
+    Client& focused = *target();
 
     if (wm::is_maxed(focused)) {
       wm::unmaximize_window(focused);
-      wm::set_focused(focused);
+      refocus(focused);
     }
 
-    wm::focused_client()->geom.x += x;
-    wm::focused_client()->geom.y += y;
+    focused.geom.x += x;
+    focused.geom.y += y;
 
-    xcb::move_window(wm::focused_client()->window, x, y);
+    xcb::apply_client_geometry(focused);
   }
 
-  void handler(For<Command::WindowMoveAbsolute>, Args args)
+  void handler(For<Command::WindowMoveAbsolute>, int x, int y)
   {
-    auto [x, y] = args.parse<int, int>();
-
-    if (wm::focused_client() == nullptr) {
+    if (target() == nullptr) {
       return;
     }
-    Client& focused = *wm::focused_client();
+    Client& focused = *target();
 
     if (wm::is_maxed(focused)) {
       wm::unmaximize_window(focused);
-      wm::set_focused(focused);
+      refocus(focused);
     }
 
     focused.geom.x = x;
@@ -69,35 +139,31 @@ namespace ipc {
     xcb::apply_client_geometry(focused);
   }
 
-  void handler(For<Command::WindowResize>, Args args)
+  void handler(For<Command::WindowResize>, int w, int h)
   {
-    auto [w, h] = args.parse<int, int>();
-
-    if (wm::focused_client() == nullptr) {
+    if (target() == nullptr) {
       return;
     }
-    Client& focused = *wm::focused_client();
+    Client& focused = *target();
 
     if (wm::is_maxed(focused)) {
       wm::unmaximize_window(focused);
-      wm::set_focused(focused);
+      refocus(focused);
     }
 
     wm::resize_window(focused, w, h);
   }
 
-  void handler(For<Command::WindowResizeAbsolute>, Args args)
+  void handler(For<Command::WindowResizeAbsolute>, int w, int h)
   {
-    auto [w, h] = args.parse<int, int>();
-
-    if (wm::focused_client() == nullptr) {
+    if (target() == nullptr) {
       return;
     }
-    Client& focused = *wm::focused_client();
+    Client& focused = *target();
 
     if (wm::is_maxed(focused)) {
       wm::unmaximize_window(focused);
-      wm::set_focused(focused);
+      refocus(focused);
     }
 
     // if (wm::focused_client()->min_width != 0 && w <
@@ -111,12 +177,12 @@ namespace ipc {
     xcb::apply_client_geometry(focused);
   }
 
-  void handler(For<Command::WindowMaximize>, Args args)
+  void handler(For<Command::WindowMaximize>)
   {
-    if (wm::focused_client() == nullptr) {
+    if (target() == nullptr) {
       return;
     }
-    Client& focused = *wm::focused_client();
+    Client& focused = *target();
 
     if (focused.hmaxed && focused.vmaxed) {
       wm::unmaximize_window(focused);
@@ -124,29 +190,29 @@ namespace ipc {
       wm::maximize_window(focused);
     }
 
-    wm::set_focused(focused);
+    refocus(focused);
     xcb::flush();
   }
 
-  void handler(For<Command::WindowUnmaximize>, Args args)
+  void handler(For<Command::WindowUnmaximize>)
   {
-    if (wm::focused_client() == nullptr) {
+    if (target() == nullptr) {
       return;
     }
-    Client& focused = *wm::focused_client();
+    Client& focused = *target();
 
     wm::unmaximize_window(focused);
 
-    wm::set_focused(focused);
+    refocus(focused);
     xcb::flush();
   }
 
-  void handler(For<Command::WindowHorMaximize>, Args args)
+  void handler(For<Command::WindowHorMaximize>)
   {
-    if (wm::focused_client() == nullptr) {
+    if (target() == nullptr) {
       return;
     }
-    Client& focused = *wm::focused_client();
+    Client& focused = *target();
 
     if (focused.hmaxed) {
       wm::unmaximize_window(focused);
@@ -154,16 +220,16 @@ namespace ipc {
       wm::hmaximize_window(focused);
     }
 
-    wm::set_focused(focused);
+    refocus(focused);
     xcb::flush();
   }
 
-  void handler(For<Command::WindowVerMaximize>, Args args)
+  void handler(For<Command::WindowVerMaximize>)
   {
-    if (wm::focused_client() == nullptr) {
+    if (target() == nullptr) {
       return;
     }
-    Client& focused = *wm::focused_client();
+    Client& focused = *target();
 
     if (focused.vmaxed) {
       wm::unmaximize_window(focused);
@@ -171,68 +237,64 @@ namespace ipc {
       wm::vmaximize_window(focused);
     }
 
-    wm::set_focused(focused);
+    refocus(focused);
     xcb::flush();
   }
 
-  void handler(For<Command::WindowClose>, Args args)
+  void handler(For<Command::WindowClose>)
   {
-    if (auto* focused = wm::focused_client(); focused != nullptr) {
+    if (auto* focused = target(); focused != nullptr) {
       xcb::close_window(*focused);
     }
   }
 
-  void handler(For<Command::WindowPutInGrid>, Args args)
+  void handler(For<Command::WindowPutInGrid>,
+               int grid_width,
+               int grid_height,
+               int grid_x,
+               int grid_y)
   {
-    auto [grid_width, grid_height, grid_x, grid_y] =
-      args.parse<int, int, int, int>();
-
-    if (auto* focused = wm::focused_client();
+    if (auto* focused = target();
         focused != nullptr && grid_x < grid_width && grid_y < grid_height) {
-      wm::grid_window(*wm::focused_client(), grid_width, grid_height, grid_x,
+      wm::grid_window(*target(), grid_width, grid_height, grid_x,
                       grid_y);
     }
   }
 
-  void handler(For<Command::WindowSnap>, Args args)
+  void handler(For<Command::WindowSnap>, Position pos)
   {
-    auto [pos] = args.parse<Position>();
-    wm::snap_window(*wm::focused_client(), pos);
+    if (auto* client = target()) wm::snap_window(*client, pos);
   }
 
-  void handler(For<Command::WindowCycle>, Args args)
+  void handler(For<Command::WindowCycle>)
   {
     wm::cycle_window(*wm::focused_client());
   }
 
-  void handler(For<Command::WindowRevCycle>, Args args)
+  void handler(For<Command::WindowRevCycle>)
   {
     wm::rcycle_window(*wm::focused_client());
   }
 
-  void handler(For<Command::WindowCardinalFocus>, Args args)
+  void handler(For<Command::WindowCardinalFocus>, direction mode)
   {
-    auto [mode] = args.parse<direction>();
     wm::cardinal_focus(mode);
   }
 
-  void handler(For<Command::WindowCardinalMove>, Args args)
+  void handler(For<Command::WindowCardinalMove>, direction mode)
   {
-    auto [mode] = args.parse<direction>();
-    if (auto focus = wm::focused_client()) wm::cardinal_move(*focus, mode);
+    if (auto focus = target()) wm::cardinal_move(*focus, mode);
   }
 
-  void handler(For<Command::WindowCardinalGrow>, Args args)
+  void handler(For<Command::WindowCardinalGrow>, direction mode)
   {
-    auto [mode] = args.parse<direction>();
-    if (auto focus = wm::focused_client())
+    if (auto focus = target())
       wm::cardinal_resize(*focus, mode, false);
   }
 
-  void handler(For<Command::WindowCardinalShrink>, Args args)
+  void handler(For<Command::WindowCardinalShrink>, direction mode)
   {
-    auto [mode] = args.parse<direction>();
-    if (auto focus = wm::focused_client())
+    if (auto focus = target())
       wm::cardinal_resize(*focus, mode, true);
   }
 
@@ -251,27 +313,26 @@ namespace ipc {
   //    rcycle_window_in_workspace(wm::focused_client());
   //  }
 
-  void handler(For<Command::WindowFocus>, Args args)
+  void handler(For<Command::WindowFocus>, xcb_window_t window)
   {
-    Client* client = wm::find_client(args.parse<0, xcb_window_t>());
+    Client* client = wm::find_client(window);
 
     if (client != nullptr) {
       wm::set_focused(*client);
     }
   }
 
-  void handler(For<Command::WindowFocusLast>, Args args)
+  void handler(For<Command::WindowFocusLast>)
   {
     if (wm::focused_client() != nullptr) {
       wm::set_focused_last_best();
     }
   }
 
-  void handler(For<Command::WorkspaceAddWindow>, Args args)
+  void handler(For<Command::WorkspaceAddWindow>, int ws)
   {
-    if (wm::focused_client() != nullptr) {
-      wm::workspace_add_window(*wm::focused_client(),
-                               wm::get_workspace(args.parse<0, int>() - 1));
+    if (target() != nullptr) {
+      wm::workspace_add_window(*target(), wm::get_workspace(ws - 1));
     }
   }
 
@@ -287,14 +348,13 @@ namespace ipc {
   //    workspace_remove_all_windows(d[0] - 1);
   //  }
 
-  void handler(For<Command::WorkspaceGoto>, Args args)
+  void handler(For<Command::WorkspaceGoto>, int ws)
   {
-    wm::workspace_goto(wm::get_workspace(args.parse<0, int>() - 1));
+    wm::workspace_goto(wm::get_workspace(ws - 1));
   }
 
-  void handler(For<Command::WorkspaceSetBar>, Args args)
+  void handler(For<Command::WorkspaceSetBar>, int ws, int mode)
   {
-    auto [ws, mode] = args.parse<int, int>();
     Workspace& workspace =
       ws == 0 ? wm::current_ws() : wm::get_workspace(ws - 1);
     workspace.bar_shown = (mode > 1 ? !workspace.bar_shown : (mode != 0));
@@ -305,7 +365,7 @@ namespace ipc {
     }
   }
 
-  void handler(For<Command::WMQuit>, Args args)
+  void handler(For<Command::WMQuit>, int code)
   {
     wm::halt = false;
     for (auto& ws : wm::workspaces()) {
@@ -314,7 +374,6 @@ namespace ipc {
         wm::halt = false;
       }
     }
-    auto code        = args.parse<0, int>();
     wm::should_close = true;
     if (code > 0) {
       wm::halt = true;
@@ -322,126 +381,364 @@ namespace ipc {
     wm::exit_code = code;
   }
 
-  void handler(For<Command::WMConfig>, Args args)
+  /// Work left to do after changing settings, so a batch of them, like a
+  /// config file, is applied once
+  enum ConfigEffects : unsigned {
+    NoEffects      = 0,
+    RefreshBorders = 1 << 0,
+    GrabButtons    = 1 << 1,
+    FitWindows     = 1 << 2,
+  };
+
+  /// Number of values a setting takes after its key
+  constexpr std::size_t config_values(Config key)
+  {
+    switch (key) {
+    case Config::GapWidth: return 2;
+    case Config::PointerActions: return std::size(xcb::mouse_buttons);
+    case Config::BarPadding: return 3;
+    default: return 1;
+    }
+  }
+
+  /// Parse `arg` as `T` into `field`, which is left as is if that fails
+  ///
+  /// \returns `effects`, or the error
+  template<typename T, typename Field>
+  Expected<unsigned> assign(Field& field,
+                            Arg const& arg,
+                            unsigned effects = NoEffects)
   {
-    auto key = args.parse<0, Config>();
-    DMSG("Setting config %s", args[0].c_str());
+    auto value = try_parse<T>(arg);
+    if (!value) return std::move(value.error());
+    field = *value;
+    return effects;
+  }
+
+  /// Change the setting named by the first arg, without applying it. All
+  /// values are parsed before the setting changes, so a bad one changes
+  /// nothing.
+  ///
+  /// \returns what has to be done to apply it, see `apply_config`, or the
+  /// error if the key or a value is invalid
+  Expected<unsigned> set_config(Args args)
+  {
+    if (args.size() == 0) return Error{"Expected a config key"};
+    auto key_or = args.try_parse<0, Config>();
+    if (!key_or) return std::move(key_or.error());
+    auto key    = *key_or;
+    auto values = config_values(key);
+    if (args.size() != values + 1) {
+      return Error{str_join(names::configs.name_of(key), " takes ", values,
+                            values == 1 ? " value" : " values", ", not ",
+                            args.size() - 1)};
+    }
+    DMSG("Setting config %s\n", args[0].c_str());
 
     switch (key) {
     case Config::BorderWidth:
-      wm::conf.border_width = args.parse<1, int>();
-      if (wm::conf.apply_settings) {
-        wm::refresh_borders();
-      }
-      break;
+      return assign<int>(wm::conf.border_width, args.at(1), RefreshBorders);
     case Config::ColorFocused:
-      wm::conf.focus_color = args.parse<1, unsigned>();
-      if (wm::conf.apply_settings) {
-        wm::refresh_borders();
-      }
-      break;
+      return assign<unsigned>(wm::conf.focus_color, args.at(1), RefreshBorders);
     case Config::ColorUnfocused:
-      wm::conf.unfocus_color = args.parse<1, unsigned>();
-      if (wm::conf.apply_settings) {
-        wm::refresh_borders();
-      }
-      break;
-    case Config::GapWidth:
-      switch (args.parse<1, Position>()) {
-      case LEFT: wm::conf.gap_left = args.parse<2, int>(); break;
-      case BOTTOM: wm::conf.gap_down = args.parse<2, int>(); break;
-      case TOP: wm::conf.gap_up = args.parse<2, int>(); break;
-      case RIGHT: wm::conf.gap_right = args.parse<2, int>(); break;
+      return assign<unsigned>(wm::conf.unfocus_color, args.at(1),
+                              RefreshBorders);
+    case Config::GapWidth: {
+      auto pos_or = args.try_parse<1, Position>();
+      if (!pos_or) return std::move(pos_or.error());
+      auto gap_or = args.try_parse<2, int>();
+      if (!gap_or) return std::move(gap_or.error());
+      auto gap = *gap_or;
+      switch (*pos_or) {
+      case LEFT: wm::conf.gap_left = gap; break;
+      case BOTTOM: wm::conf.gap_down = gap; break;
+      case TOP: wm::conf.gap_up = gap; break;
+      case RIGHT: wm::conf.gap_right = gap; break;
       case ALL:
-        // wm::conf.gap_left = conf.gap_down = conf.gap_up = conf.gap_right =
-        // d[2];
-      default: break;
+        wm::conf.gap_left = wm::conf.gap_down = wm::conf.gap_up =
+          wm::conf.gap_right = gap;
+        break;
+      default: return Error{"Gaps are left, bottom, top, right or all"};
       }
-      break;
-    case Config::GridGapWidth: wm::conf.grid_gap = args.parse<1, int>();
+    } break;
+    case Config::GridGapWidth:
+      return assign<int>(wm::conf.grid_gap, args.at(1));
     case Config::CursorPosition:
-      wm::conf.cursor_position = args.parse<1, Position>();
-      break;
+      return assign<Position>(wm::conf.cursor_position, args.at(1));
       //    case Config::WorkspacesNr: change_nr_of_workspaces(d[1]); break;
     case Config::EnableSloppyFocus:
-      wm::conf.sloppy_focus = args.parse<1, bool>();
-      break;
+      return assign<bool>(wm::conf.sloppy_focus, args.at(1));
     case Config::EnableResizeHints:
-      wm::conf.resize_hints = args.parse<1, bool>();
+      return assign<bool>(wm::conf.resize_hints, args.at(1));
     case Config::StickyWindows:
-      wm::conf.sticky_windows = args.parse<1, bool>();
-      break;
-    case Config::EnableBorders: wm::conf.borders = args.parse<1, bool>(); break;
+      return assign<bool>(wm::conf.sticky_windows, args.at(1));
+    case Config::EnableBorders:
+      return assign<bool>(wm::conf.borders, args.at(1));
     case Config::EnableLastWindowFocusing:
-      wm::conf.last_window_focusing = args.parse<1, bool>();
-      break;
+      return assign<bool>(wm::conf.last_window_focusing, args.at(1));
     case Config::ApplySettings:
-      wm::conf.apply_settings = args.parse<1, bool>();
-      break;
+      return assign<bool>(wm::conf.apply_settings, args.at(1));
     case Config::ReplayClickOnFocus:
-      wm::conf.replay_click_on_focus = args.parse<1, bool>();
-      break;
-    case Config::PointerActions:
-      for (int i = 0; i < underlying(Buttons::Count); i++) {
-        wm::conf.pointer_actions[i] = args.parse<PointerAction>(i);
+      return assign<bool>(wm::conf.replay_click_on_focus, args.at(1));
+    case Config::PointerActions: {
+      // One for each of the left, middle and right buttons
+      PointerAction actions[std::size(xcb::mouse_buttons)];
+      for (std::size_t i = 0; i < std::size(actions); i++) {
+        auto res = assign<PointerAction>(actions[i], args.at(i + 1));
+        if (!res) return std::move(res.error());
       }
-      wm::ungrab_buttons();
-      wm::grab_buttons();
-      break;
+      std::copy(std::begin(actions), std::end(actions),
+                wm::conf.pointer_actions.begin());
+      return GrabButtons;
+    }
     case Config::PointerModifier:
-      wm::conf.pointer_modifier = args.parse<1, int>();
-      wm::ungrab_buttons();
-      wm::grab_buttons();
-      break;
+      // A mask, or the name of a modifier
+      if (auto mask = try_parse<xcb_mod_mask_t>(args.at(1))) {
+        wm::conf.pointer_modifier = *mask;
+        return GrabButtons;
+      }
+      return assign<int>(wm::conf.pointer_modifier, args.at(1), GrabButtons);
     case Config::ClickToFocus: {
-      auto val = args.parse<1, int>();
-      if (val == UINT32_MAX) {
-        wm::conf.click_to_focus = -1;
+      // The name of a button, or its number. Numbers are never looked up as
+      // names, binary requests would get the enum value instead.
+      int val;
+      auto* name  = std::get_if<std::string_view>(&args.at(1));
+      auto button = name != nullptr ? names::buttons.find(*name) : std::nullopt;
+      if (button) {
+        switch (*button) {
+        case Buttons::Any: val = XCB_BUTTON_INDEX_ANY; break;
+        case Buttons::None: val = -1; break;
+        default: val = xcb::mouse_buttons[underlying(*button)]; break;
+        }
       } else {
-        wm::conf.click_to_focus = val;
+        auto number = args.try_parse<1, int>();
+        if (!number) return std::move(number.error());
+        val = *number;
+        if (val != -1 && val != XCB_BUTTON_INDEX_ANY &&
+            (val < XCB_BUTTON_INDEX_1 || val > XCB_BUTTON_INDEX_3)) {
+          return Error{
+            str_join(val, " is not a button (1 to 3, 0 for any, -1 for none)")};
+        }
       }
+      wm::conf.click_to_focus = val;
+      return GrabButtons;
+    }
+    case Config::BarPadding: {
+      auto left  = args.try_parse<1, int>();
+      auto top   = args.try_parse<2, int>();
+      auto right = args.try_parse<3, int>();
+      for (auto* value : {&left, &top, &right}) {
+        if (!*value) return std::move(value->error());
+      }
+      wm::conf.bar_padding[0] = *left;
+      wm::conf.bar_padding[1] = *top;
+      wm::conf.bar_padding[2] = *right;
+      // conf.bar_padding[3] = d[4];
+      return FitWindows;
+    }
+    default: DMSG("!!! unhandled config key %d\n", static_cast<int>(key)); break;
+    }
+    return NoEffects;
+  }
+
+  /// Apply settings changed by `set_config`
+  void apply_config(unsigned effects)
+  {
+    if ((effects & RefreshBorders) && wm::conf.apply_settings) {
+      wm::refresh_borders();
+    }
+    if (effects & GrabButtons) {
       wm::ungrab_buttons();
       wm::grab_buttons();
-    } break;
-    case Config::BarPadding:
-      wm::conf.bar_padding[0] = args.parse<1, int>();
-      wm::conf.bar_padding[1] = args.parse<2, int>();
-      wm::conf.bar_padding[2] = args.parse<3, int>();
-      // conf.bar_padding[3] = d[4];
+    }
+    if (effects & FitWindows) {
       for (auto& win : wm::current_ws().windows) {
         wm::fit_on_screen(win);
       }
-      break;
-    default: DMSG("!!! unhandled config key %d\n", key); break;
     }
   }
 
-  void handler(For<Command::WindowConfig>, Args args)
+  Expected<std::string> handler(For<Command::WMConfig>, Args args)
+  {
+    auto effects = set_config(args);
+    if (!effects) return std::move(effects.error());
+    apply_config(*effects);
+    return std::string();
+  }
+
+  /// All window configs are flags so far
+  void handler(For<Command::WindowConfig>,
+               WinConfig key,
+               xcb_window_t win,
+               bool value)
   {
-    auto [key, win] = args.parse<WinConfig, xcb_window_t>();
     Client* cl_ptr = wm::find_client(win);
 
-    DMSG("Window config %s for window %x", args[0].c_str(), win);
+    DMSG("Window config %d for window %x", static_cast<int>(key), win);
     if (cl_ptr == nullptr) {
       DMSG("Window config for nonexistant window %x", win);
       return;
     }
-    args.shift(2);
     auto& client = *cl_ptr;
     switch (key) {
-    case ipc::WinConfig::AllowOffscreen:
-      client.allow_offscreen = args.parse<0, bool>();
-      break;
-    default: DMSG("!!! unhandled config key %d\n", key); break;
+    case ipc::WinConfig::AllowOffscreen: client.allow_offscreen = value; break;
+    default: DMSG("!!! unhandled config key %d\n", static_cast<int>(key)); break;
     }
   }
 
-  std::string handler(For<Command::GetFocused>, Args args)
+  std::string handler(For<Command::GetFocused>)
   {
     auto focused = wm::focused_client();
     if (focused == nullptr) return "";
     return std::to_string(focused->window);
   }
 
+  void handler(For<Command::Subscribe>, EventMask mask)
+  {
+    subscribe(mask);
+  }
+
+  std::optional<std::string> check(Predicate const& pred)
+  {
+    switch (pred.kind) {
+    case Predicate::Mapped:
+      for (auto& ws : wm::workspaces()) {
+        for (auto& cl : ws.windows) {
+          if (cl.mapped && (cl.class_name == pred.window_class ||
+                            cl.instance_name == pred.window_class)) {
+            return std::to_string(cl.window);
+          }
+        }
+      }
+      break;
+    case Predicate::Focus: {
+      auto focused = wm::focused_client();
+      if (focused != nullptr && focused->window != pred.focused) {
+        return std::to_string(focused->window);
+      }
+    } break;
+    case Predicate::Empty:
+      if (pred.workspace < wm::workspaces().size() &&
+          wm::workspaces()[pred.workspace].windows.empty()) {
+        return "";
+      }
+      break;
+    }
+    return std::nullopt;
+  }
+
+  std::string handler(For<Command::WaitFor>,
+                      Predicate pred,
+                      std::optional<int> timeout_ms)
+  {
+    if (pred.kind == Predicate::Focus) {
+      auto focused = wm::focused_client();
+      pred.focused = focused == nullptr ? XCB_NONE : focused->window;
+    }
+    if (auto res = check(pred)) return *res;
+
+    std::optional<std::chrono::milliseconds> timeout;
+    if (timeout_ms) timeout = std::chrono::milliseconds(*timeout_ms);
+    wait_for(std::move(pred), timeout);
+    return "";
+  }
+
+  /// Shared by `after` and `every`
+  ///
+  /// \returns the id of the timer, or the error
+  Expected<std::string> schedule_command(Args args, bool repeat)
+  {
+    if (args.size() < 2) return Error{"Expected a delay and a command"};
+    auto delay = args.try_parse<0, int>();
+    if (!delay) return std::move(delay.error());
+    if (*delay < (repeat ? 1 : 0)) {
+      return Error{str_join("Invalid delay ", *delay)};
+    }
+    auto cmd = args.try_parse<1, Command>();
+    if (!cmd) return std::move(cmd.error());
+    args.shift(2);
+    auto id = schedule(std::chrono::milliseconds(*delay), repeat, *cmd,
+                       std::move(args));
+    if (!id) return std::move(id.error());
+    return std::to_string(*id);
+  }
+
+  Expected<std::string> handler(For<Command::After>, Args args)
+  {
+    return schedule_command(std::move(args), false);
+  }
+
+  Expected<std::string> handler(For<Command::Every>, Args args)
+  {
+    return schedule_command(std::move(args), true);
+  }
+
+  Expected<std::string> handler(For<Command::Cancel>, unsigned id)
+  {
+    if (!cancel(id)) return Error{str_join("No scheduled command has id ", id)};
+    return std::string();
+  }
+
+  void handler(For<Command::DefineMacro>, Args args)
+  {
+    auto name = args[0];
+    args.shift(1);
+    define_macro(name, args);
+  }
+
+  Expected<std::string> handler(For<Command::RunMacro>, std::string_view name)
+  {
+    return run_macro(name);
+  }
+
+  void handler(For<Command::Begin>)
+  {
+    begin_transaction();
+  }
+
+  void handler(For<Command::Commit>)
+  {
+    commit_transaction();
+  }
+
+  std::string handler(For<Command::ListCommands>)
+  {
+    return names::commands.names('\n');
+  }
+
+  /// Set the level of the messages logged, and return it
+  std::string handler(For<Command::LogLevel>, std::optional<logging::Level> level)
+  {
+    if (level) logging::set_level(*level);
+    return std::string(names::log_levels.name_of(logging::level()));
+  }
+
+  Expected<std::string> handler(For<Command::GetTree>, Args args)
+  {
+    if (args.size() > 0 && args[0] == "--format") args.shift(1);
+    if (args.size() > 1) {
+      return Error{str_join("get_tree takes a format, not ", args.size(),
+                            " arguments")};
+    }
+    auto format = tree::Format::Json;
+    if (args.size() > 0) {
+      auto parsed = try_parse<tree::Format>(args.at(0));
+      if (!parsed) return parsed.error();
+      format = *parsed;
+    }
+    // Small trees are written faster than they are handed over
+    constexpr std::size_t worker_windows = 16;
+    auto snap = tree::snapshot();
+    auto work = [snap, format] {
+      std::string res;
+      tree::write(res, *snap, format);
+      return res;
+    };
+    if (snap->window_count >= worker_windows && respond_later(work)) {
+      return std::string();
+    }
+    return work();
+  }
+
 } // namespace ipc
 
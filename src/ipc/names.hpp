@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/// Name tables for the enums set by requests.
+///
+/// Each enum has one array of `Entry`s, which is the only place its names
+/// are spelled. `make_table` turns it into a `Table` at compile time, with a
+/// perfect hash for the lookup, and checks that it names every value.
+namespace ipc::names {
+
+  template<typename E>
+  struct Entry {
+    std::string_view name;
+    E value;
+  };
+
+  constexpr char to_lower(char c) noexcept
+  {
+    return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+  }
+
+  /// Case insensitive comparison, for names typed by users
+  constexpr bool iequals(std::string_view a, std::string_view b) noexcept
+  {
+    if (a.size() != b.size()) return false;
+    for (std::size_t i = 0; i < a.size(); i++) {
+      if (to_lower(a[i]) != to_lower(b[i])) return false;
+    }
+    return true;
+  }
+
+  /// FNV-1a of the lowercased name, so case insensitive tables can use it.
+  ///
+  /// The low bits of FNV hardly depend on the seed, so they are mixed with
+  /// the high ones before being used as a slot.
+  constexpr std::uint32_t hash(std::string_view str, std::uint32_t seed) noexcept
+  {
+    std::uint32_t res = 2166136261u ^ seed;
+    for (char c : str) {
+      res ^= static_cast<std::uint8_t>(to_lower(c));
+      res *= 16777619u;
+    }
+    res ^= res >> 16;
+    res *= 0x85ebca6bu;
+    res ^= res >> 13;
+    return res;
+  }
+
+  /// Number of hash slots for `n` names. A power of two, and sparse enough
+  /// that a collision free seed is found in a few tries.
+  constexpr std::size_t slots_for(std::size_t n) noexcept
+  {
+    std::size_t res = 1;
+    while (res < 4 * n) res *= 2;
+    return res;
+  }
+
+  template<typename E, std::size_t N, bool CaseSensitive>
+  struct Table {
+    static constexpr std::size_t n_slots = slots_for(N);
+    static_assert(N < 256, "Slots hold the entry index in a byte");
+
+    std::array<Entry<E>, N> entries = {};
+    std::uint32_t seed               = 0;
+    /// Index of the entry in the slot, plus one. Zero for an empty slot.
+    std::array<std::uint8_t, n_slots> slots = {};
+
+    constexpr std::optional<E> find(std::string_view name) const noexcept
+    {
+      auto slot = slots[hash(name, seed) & (n_slots - 1)];
+      if (slot == 0) return std::nullopt;
+      auto& entry = entries[slot - 1];
+      bool match  = CaseSensitive ? entry.name == name : iequals(entry.name, name);
+      if (!match) return std::nullopt;
+      return entry.value;
+    }
+
+    /// The first name of `value`, or an empty string
+    constexpr std::string_view name_of(E value) const noexcept
+    {
+      for (auto& entry : entries) {
+        if (entry.value == value) return entry.name;
+      }
+      return {};
+    }
+
+    /// Whether all values below `n` have a name
+    constexpr bool covers(std::size_t n) const noexcept
+    {
+      for (std::size_t i = 0; i < n; i++) {
+        if (name_of(static_cast<E>(i)).empty()) return false;
+      }
+      return true;
+    }
+
+    /// All names, separated by `sep`, for error messages and listings
+    std::string names(char sep = '|') const
+    {
+      std::string res;
+      for (auto& entry : entries) {
+        if (!res.empty()) res += sep;
+        res += entry.name;
+      }
+      return res;
+    }
+  };
+
+  /// Build the table for `entries`, searching for a seed that gives every
+  /// name its own slot. Fails to compile if names repeat, as no seed does.
+  template<bool CaseSensitive = true, typename E, std::size_t N>
+  constexpr auto make_table(Entry<E> const (&entries)[N])
+  {
+    Table<E, N, CaseSensitive> res;
+    for (std::size_t i = 0; i < N; i++) res.entries[i] = entries[i];
+
+    constexpr auto mask = Table<E, N, CaseSensitive>::n_slots - 1;
+    for (std::uint32_t seed = 0; seed < 4096; seed++) {
+      res.seed  = seed;
+      res.slots = {};
+      bool perfect = true;
+      for (std::size_t i = 0; i < N && perfect; i++) {
+        auto& slot = res.slots[hash(entries[i].name, seed) & mask];
+        perfect    = slot == 0;
+        slot       = static_cast<std::uint8_t>(i + 1);
+      }
+      if (perfect) return res;
+    }
+    throw std::logic_error("No perfect hash for the names");
+  }
+
+} // namespace ipc::names
@@ -1,175 +1,456 @@
 #pragma once
 
+#include <charconv>
+#include <limits>
+#include <optional>
+#include <string_view>
+
+#include "../log.hpp"
 #include "../types.hpp"
 #include "../util.hpp"
+#include "names.hpp"
 #include "server.hpp"
+#include "tree.hpp"
 
 namespace ipc {
 
+  /// Parse a whole string as an integer, in decimal, or in hexadecimal with
+  /// a `0x` prefix.
+  ///
+  /// \returns nothing if it isn't a number, or doesn't fit in `T`
+  template<typename T>
+  std::optional<T> to_integer(std::string_view str) noexcept
+  {
+    bool negative = !str.empty() && str[0] == '-';
+    if (negative || (!str.empty() && str[0] == '+')) str.remove_prefix(1);
+    int base = 10;
+    if (str.size() > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+      str.remove_prefix(2);
+      base = 16;
+    }
+
+    unsigned long long value;
+    auto* end = str.data() + str.size();
+    auto res  = std::from_chars(str.data(), end, value, base);
+    if (str.empty() || res.ec != std::errc() || res.ptr != end) {
+      return std::nullopt;
+    }
+    using Limits = std::numeric_limits<T>;
+    if (!negative) {
+      if (value > static_cast<unsigned long long>(Limits::max())) {
+        return std::nullopt;
+      }
+      return static_cast<T>(value);
+    }
+    if constexpr (std::is_unsigned_v<T>) {
+      return std::nullopt;
+    } else {
+      if (value > static_cast<unsigned long long>(Limits::max()) + 1) {
+        return std::nullopt;
+      }
+      // Written so the most negative value doesn't overflow
+      return static_cast<T>(-static_cast<T>(value - 1) - 1);
+    }
+  }
+
   template<>
-  auto parse<int>(std::string const& str) -> int
+  auto try_parse<int>(std::string_view str) -> Expected<int>
   {
-    return std::stoi(str, nullptr, 0);
+    if (auto res = to_integer<int>(str)) return *res;
+    return Error{str_join("'", str, "' could not be parsed as a number")};
   }
 
   template<>
-  auto parse<unsigned>(std::string const& str) -> unsigned
+  auto try_parse<unsigned>(std::string_view str) -> Expected<unsigned>
   {
-    return std::stoul(str, nullptr, 0);
+    if (auto res = to_integer<unsigned>(str)) return *res;
+    return Error{
+      str_join("'", str, "' could not be parsed as a positive number")};
   }
 
   template<>
-  auto parse<bool>(std::string const& str) -> bool
+  auto try_parse<std::string_view>(std::string_view str)
+    -> Expected<std::string_view>
+  {
+    return str;
+  }
+
+  template<>
+  auto try_parse<bool>(std::string_view str) -> Expected<bool>
   {
     return (str == "true" || str == "yes" || str == "y" || str == "t" ||
             str == "1");
   }
 
+  namespace names {
+
+    constexpr Entry<Command> command_entries[] = {
+      {"window_move", Command::WindowMove},
+      {"window_move_absolute", Command::WindowMoveAbsolute},
+      {"window_resize", Command::WindowResize},
+      {"window_resize_absolute", Command::WindowResizeAbsolute},
+      {"window_maximize", Command::WindowMaximize},
+      {"window_unmaximize", Command::WindowUnmaximize},
+      {"window_hor_maximize", Command::WindowHorMaximize},
+      {"window_ver_maximize", Command::WindowVerMaximize},
+      {"window_close", Command::WindowClose},
+      {"window_put_in_grid", Command::WindowPutInGrid},
+      {"window_snap", Command::WindowSnap},
+      {"window_cycle", Command::WindowCycle},
+      {"window_rev_cycle", Command::WindowRevCycle},
+      {"window_cardinal_focus", Command::WindowCardinalFocus},
+      {"window_cardinal_move", Command::WindowCardinalMove},
+      {"window_cardinal_grow", Command::WindowCardinalGrow},
+      {"window_cardinal_shrink", Command::WindowCardinalShrink},
+      {"window_focus", Command::WindowFocus},
+      {"window_focus_last", Command::WindowFocusLast},
+      {"workspace_add_window", Command::WorkspaceAddWindow},
+      {"workspace_goto", Command::WorkspaceGoto},
+      {"workspace_set_bar", Command::WorkspaceSetBar},
+      {"wm_quit", Command::WMQuit},
+      {"wm_config", Command::WMConfig},
+      {"win_config", Command::WindowConfig},
+      {"get_focused", Command::GetFocused},
+      {"subscribe", Command::Subscribe},
+      {"wait_for", Command::WaitFor},
+      {"after", Command::After},
+      {"every", Command::Every},
+      {"cancel", Command::Cancel},
+      {"define_macro", Command::DefineMacro},
+      {"run_macro", Command::RunMacro},
+      {"get_tree", Command::GetTree},
+      {"begin", Command::Begin},
+      {"commit", Command::Commit},
+      {"list_commands", Command::ListCommands},
+      {"log_level", Command::LogLevel},
+    };
+    constexpr auto commands = make_table(command_entries);
+    static_assert(commands.covers(n_commands), "A command has no name");
+
+    constexpr Entry<Config> config_entries[] = {
+      {"border_width", Config::BorderWidth},
+      {"color_focused", Config::ColorFocused},
+      {"color_unfocused", Config::ColorUnfocused},
+      {"gap_width", Config::GapWidth},
+      {"grid_gap_width", Config::GridGapWidth},
+      {"cursor_position", Config::CursorPosition},
+      {"workspaces_nr", Config::WorkspacesNr},
+      {"enable_sloppy_focus", Config::EnableSloppyFocus},
+      {"enable_resize_hints", Config::EnableResizeHints},
+      {"sticky_windows", Config::StickyWindows},
+      {"enable_borders", Config::EnableBorders},
+      {"enable_last_window_focusing", Config::EnableLastWindowFocusing},
+      {"apply_settings", Config::ApplySettings},
+      {"replay_click_on_focus", Config::ReplayClickOnFocus},
+      {"pointer_actions", Config::PointerActions},
+      {"pointer_modifier", Config::PointerModifier},
+      {"click_to_focus", Config::ClickToFocus},
+      {"bar_padding", Config::BarPadding},
+    };
+    constexpr auto configs = make_table(config_entries);
+    static_assert(configs.covers(n_configs), "A config has no name");
+
+    constexpr Entry<WinConfig> win_config_entries[] = {
+      {"allow_offscreen", WinConfig::AllowOffscreen},
+    };
+    constexpr auto win_configs = make_table(win_config_entries);
+    static_assert(win_configs.covers(n_win_configs),
+                  "A window config has no name");
+
+    constexpr Entry<direction> direction_entries[] = {
+      {"up", direction::NORTH},   {"north", direction::NORTH},
+      {"down", direction::SOUTH}, {"south", direction::SOUTH},
+      {"left", direction::WEST},  {"west", direction::WEST},
+      {"right", direction::EAST}, {"east", direction::EAST},
+    };
+    constexpr auto directions = make_table<false>(direction_entries);
+    static_assert(directions.covers(direction::WEST + 1));
+
+    constexpr Entry<PointerAction> pointer_action_entries[] = {
+      {"nothing", PointerAction::Nothing},
+      {"focus", PointerAction::Focus},
+      {"move", PointerAction::Move},
+      {"resize_corner", PointerAction::ResizeCorner},
+      {"resize_side", PointerAction::ResizeSide},
+    };
+    constexpr auto pointer_actions = make_table<false>(pointer_action_entries);
+    static_assert(pointer_actions.covers(
+      underlying(PointerAction::ResizeSide) + 1));
+
+    constexpr Entry<xcb_mod_mask_t> modifier_entries[] = {
+      {"alt", XCB_MOD_MASK_1},
+      {"super", XCB_MOD_MASK_4},
+    };
+    constexpr auto modifiers = make_table<false>(modifier_entries);
+
+    constexpr Entry<Buttons> button_entries[] = {
+      {"left", Buttons::Left}, {"middle", Buttons::Middle},
+      {"right", Buttons::Right}, {"none", Buttons::None},
+      {"any", Buttons::Any},
+    };
+    constexpr auto buttons = make_table<false>(button_entries);
+    static_assert(buttons.covers(underlying(Buttons::Count)));
+
+    constexpr Entry<Position> position_entries[] = {
+      {"topleft", Position::TOP_LEFT},
+      {"topright", Position::TOP_RIGHT},
+      {"bottomleft", Position::BOTTOM_LEFT},
+      {"bottomright", Position::BOTTOM_RIGHT},
+      {"middle", Position::CENTER},
+      {"left", Position::LEFT},
+      {"bottom", Position::BOTTOM},
+      {"top", Position::TOP},
+      {"right", Position::RIGHT},
+      {"all", Position::ALL},
+    };
+    constexpr auto positions = make_table<false>(position_entries);
+    static_assert(positions.covers(Position::ALL + 1));
+
+    /// Without `all`, which isn't an event
+    constexpr Entry<Event> event_entries[] = {
+      {"focus", Event::Focus},
+      {"map", Event::Map},
+      {"unmap", Event::Unmap},
+      {"destroy", Event::Destroy},
+      {"workspace", Event::Workspace},
+    };
+    constexpr auto events = make_table<false>(event_entries);
+
+    constexpr Entry<tree::Format> format_entries[] = {
+      {"json", tree::Format::Json},
+      {"tsv", tree::Format::Tsv},
+    };
+    constexpr auto formats = make_table(format_entries);
+
+    constexpr Entry<logging::Level> log_level_entries[] = {
+      {"error", logging::Level::Error},
+      {"info", logging::Level::Info},
+      {"debug", logging::Level::Debug},
+    };
+    constexpr auto log_levels = make_table<false>(log_level_entries);
+    static_assert(log_levels.covers(int(logging::Level::Debug) + 1));
+
+  } // namespace names
+
+  /// Look `str` up in `table`, or throw an error naming `what` it should have
+  /// been, and the names it can be
+  template<typename E, std::size_t N, bool CaseSensitive>
+  Expected<E> lookup(names::Table<E, N, CaseSensitive> const& table,
+                     std::string_view str,
+                     const char* what)
+  {
+    if (auto res = table.find(str)) return *res;
+    return Error{str_join("'", str, "' could not be parsed as ", what, " (",
+                          table.names(), ")")};
+  }
+
+  /// The value of `table` numbered `value`, or an error naming `what` it
+  /// should have been
+  template<typename E, std::size_t N, bool CaseSensitive>
+  Expected<E> lookup(names::Table<E, N, CaseSensitive> const& table,
+                     long value,
+                     const char* what)
+  {
+    for (auto& entry : table.entries) {
+      if (static_cast<long>(entry.value) == value) return entry.value;
+    }
+    return Error{str_join(value, " is not ", what)};
+  }
+
   template<>
-  auto parse<Command>(std::string const& str) -> Command
-  {
-    if (str == "window_move")            return ipc::Command::WindowMove;
-    if (str == "window_move_absolute")   return ipc::Command::WindowMoveAbsolute;
-    if (str == "window_resize")          return ipc::Command::WindowResize;
-    if (str == "window_resize_absolute") return ipc::Command::WindowResizeAbsolute;
-    if (str == "window_maximize")        return ipc::Command::WindowMaximize;
-    if (str == "window_unmaximize")      return ipc::Command::WindowUnmaximize;
-    if (str == "window_hor_maximize")    return ipc::Command::WindowHorMaximize;
-    if (str == "window_ver_maximize")    return ipc::Command::WindowVerMaximize;
-    if (str == "window_close")           return ipc::Command::WindowClose;
-    if (str == "window_put_in_grid")     return ipc::Command::WindowPutInGrid;
-    if (str == "window_snap")            return ipc::Command::WindowSnap;
-    if (str == "window_cycle")           return ipc::Command::WindowCycle;
-    if (str == "window_rev_cycle")       return ipc::Command::WindowRevCycle;
-    if (str == "window_cardinal_focus")  return ipc::Command::WindowCardinalFocus;
-    if (str == "window_cardinal_move")   return ipc::Command::WindowCardinalMove;
-    if (str == "window_cardinal_grow")   return ipc::Command::WindowCardinalGrow;
-    if (str == "window_cardinal_shrink") return ipc::Command::WindowCardinalShrink;
-    if (str == "window_focus")           return ipc::Command::WindowFocus;
-    if (str == "window_focus_last")      return ipc::Command::WindowFocusLast;
-    if (str == "workspace_add_window")   return ipc::Command::WorkspaceAddWindow;
-    if (str == "workspace_goto")         return ipc::Command::WorkspaceGoto;
-    if (str == "workspace_set_bar")      return ipc::Command::WorkspaceSetBar;
-    if (str == "wm_quit")                return ipc::Command::WMQuit;
-    if (str == "wm_config")              return ipc::Command::WMConfig;
-    if (str == "win_config")             return ipc::Command::WindowConfig;
-    if (str == "get_focused")            return ipc::Command::GetFocused;
-    throw std::runtime_error(str_join("No command matches '", str, "'"));
-  }
-
-  template<>
-  auto parse<Config>(std::string const& str) -> Config
-  {
-    if (str == "border_width")                return ipc::Config::BorderWidth;
-    if (str == "color_focused")               return ipc::Config::ColorFocused;
-    if (str == "color_unfocused")             return ipc::Config::ColorUnfocused;
-    if (str == "gap_width")                   return ipc::Config::GapWidth;
-    if (str == "grid_gap_width")              return ipc::Config::GridGapWidth;
-    if (str == "cursor_position")             return ipc::Config::CursorPosition;
-    if (str == "workspaces_nr")               return ipc::Config::WorkspacesNr;
-    if (str == "enable_sloppy_focus")         return ipc::Config::EnableSloppyFocus;
-    if (str == "enable_resize_hints")         return ipc::Config::EnableResizeHints;
-    if (str == "sticky_windows")              return ipc::Config::StickyWindows;
-    if (str == "enable_borders")              return ipc::Config::EnableBorders;
-    if (str == "enable_last_window_focusing") return ipc::Config::EnableLastWindowFocusing;
-    if (str == "apply_settings")              return ipc::Config::ApplySettings;
-    if (str == "replay_click_on_focus")       return ipc::Config::ReplayClickOnFocus;
-    if (str == "pointer_actions")             return ipc::Config::PointerActions;
-    if (str == "pointer_modifier")            return ipc::Config::PointerModifier;
-    if (str == "click_to_focus")              return ipc::Config::ClickToFocus;
-    if (str == "bar_padding")                 return ipc::Config::BarPadding;
-    throw std::runtime_error(str_join("No config matches '", str, "'"));
-  }
-
-  template<>
-  auto parse<WinConfig>(std::string const& str) -> WinConfig
-  {
-    if (str == "allow_offscreen") return WinConfig::AllowOffscreen;
-    throw std::runtime_error(str_join("No window config matches '", str, "'"));
-  }
-
-  template<>
-  auto parse<direction>(std::string const& str) -> direction
-  {
-    if (strcasecmp(str.c_str(), "up") == 0 ||
-        strcasecmp(str.c_str(), "north") == 0)
-      return direction::NORTH;
-    if (strcasecmp(str.c_str(), "down") == 0 ||
-        strcasecmp(str.c_str(), "south") == 0)
-      return direction::SOUTH;
-    if (strcasecmp(str.c_str(), "left") == 0 ||
-        strcasecmp(str.c_str(), "west") == 0)
-      return direction::WEST;
-    if (strcasecmp(str.c_str(), "right") == 0 ||
-        strcasecmp(str.c_str(), "east") == 0)
-      return direction::EAST;
-
-    throw std::runtime_error(
-      str_join("'", str,
-               "' could not be parsed as a direction "
-               "(up|north|down|south|left|west|right|east)"));
+  auto enum_from_integer<Command>(long value) -> Expected<Command>
+  {
+    return lookup(names::commands, value, "a command");
   }
 
   template<>
-  auto parse<PointerAction>(std::string const& str) -> PointerAction
+  auto enum_from_integer<Config>(long value) -> Expected<Config>
   {
-    if (strcasecmp(str.c_str(), "nothing") == 0) return PointerAction::Nothing;
-    if (strcasecmp(str.c_str(), "focus") == 0) return PointerAction::Focus;
-    if (strcasecmp(str.c_str(), "move") == 0) return PointerAction::Move;
-    if (strcasecmp(str.c_str(), "resize_corner") == 0)
-      return PointerAction::ResizeCorner;
-    if (strcasecmp(str.c_str(), "resize_side") == 0)
-      return PointerAction::ResizeSide;
-    throw std::runtime_error(
-      str_join("'", str,
-               "' could not be parsed as a pointer action "
-               "(nothing|focus|move|resize_corner|resize_side)"));
+    return lookup(names::configs, value, "a config");
+  }
+
+  template<>
+  auto enum_from_integer<WinConfig>(long value) -> Expected<WinConfig>
+  {
+    return lookup(names::win_configs, value, "a window config");
+  }
+
+  template<>
+  auto enum_from_integer<direction>(long value) -> Expected<direction>
+  {
+    return lookup(names::directions, value, "a direction");
+  }
+
+  template<>
+  auto enum_from_integer<PointerAction>(long value) -> Expected<PointerAction>
+  {
+    return lookup(names::pointer_actions, value, "a pointer action");
+  }
+
+  template<>
+  auto enum_from_integer<xcb_mod_mask_t>(long value) -> Expected<xcb_mod_mask_t>
+  {
+    return lookup(names::modifiers, value, "a modifier");
+  }
+
+  template<>
+  auto enum_from_integer<Buttons>(long value) -> Expected<Buttons>
+  {
+    return lookup(names::buttons, value, "a button");
+  }
+
+  template<>
+  auto enum_from_integer<Position>(long value) -> Expected<Position>
+  {
+    return lookup(names::positions, value, "a position");
+  }
+
+  template<>
+  auto enum_from_integer<tree::Format>(long value) -> Expected<tree::Format>
+  {
+    return lookup(names::formats, value, "a format");
+  }
+
+  template<>
+  auto enum_from_integer<logging::Level>(long value) -> Expected<logging::Level>
+  {
+    return lookup(names::log_levels, value, "a log level");
+  }
+
+  template<>
+  auto try_parse<Command>(std::string_view str) -> Expected<Command>
+  {
+    if (auto res = names::commands.find(str)) return *res;
+    return Error{str_join("No command matches '", str, "'")};
+  }
+
+  template<>
+  auto try_parse<Config>(std::string_view str) -> Expected<Config>
+  {
+    if (auto res = names::configs.find(str)) return *res;
+    return Error{str_join("No config matches '", str, "'")};
+  }
+
+  template<>
+  auto try_parse<WinConfig>(std::string_view str) -> Expected<WinConfig>
+  {
+    if (auto res = names::win_configs.find(str)) return *res;
+    return Error{str_join("No window config matches '", str, "'")};
+  }
+
+  template<>
+  auto try_parse<direction>(std::string_view str) -> Expected<direction>
+  {
+    return lookup(names::directions, str, "a direction");
+  }
+
+  template<>
+  auto try_parse<PointerAction>(std::string_view str) -> Expected<PointerAction>
+  {
+    return lookup(names::pointer_actions, str, "a pointer action");
+  }
+
+  template<>
+  auto try_parse<xcb_mod_mask_t>(std::string_view str) -> Expected<xcb_mod_mask_t>
+  {
+    return lookup(names::modifiers, str, "a modifier");
   }
 
   template<>
-  auto parse<xcb_mod_mask_t>(std::string const& str) -> xcb_mod_mask_t
+  auto try_parse<Buttons>(std::string_view str) -> Expected<Buttons>
   {
-    if (strcasecmp(str.c_str(), "alt") == 0) return XCB_MOD_MASK_1;
-    if (strcasecmp(str.c_str(), "super") == 0) return XCB_MOD_MASK_4;
-    throw std::runtime_error(
-      str_join("'", str, "' could not be parsed as a modifier (alt|super)"));
+    return lookup(names::buttons, str, "a button");
   }
 
   template<>
-  auto parse<Buttons>(std::string const& str) -> Buttons
+  auto try_parse<Position>(std::string_view str) -> Expected<Position>
   {
-    if (strcasecmp(str.c_str(), "left") == 0) return Buttons::Left;
-    if (strcasecmp(str.c_str(), "middle") == 0) return Buttons::Middle;
-    if (strcasecmp(str.c_str(), "right") == 0) return Buttons::Right;
-    if (strcasecmp(str.c_str(), "none") == 0) return Buttons::None;
-    if (strcasecmp(str.c_str(), "any") == 0) return Buttons::Any;
-    throw std::runtime_error(str_join(
-      "'", str,
-      "' could not be parsed as a button (left|middle|right|none|any)"));
+    return lookup(names::positions, str, "a position");
   }
 
   template<>
-  auto parse<Position>(std::string const& str) -> Position
+  auto try_parse<EventMask>(std::string_view str) -> Expected<EventMask>
   {
-    if (strcasecmp(str.c_str(), "topleft") == 0) return Position::TOP_LEFT;
-    if (strcasecmp(str.c_str(), "topright") == 0) return Position::TOP_RIGHT;
-    if (strcasecmp(str.c_str(), "bottomleft") == 0)
-      return Position::BOTTOM_LEFT;
-    if (strcasecmp(str.c_str(), "bottomright") == 0)
-      return Position::BOTTOM_RIGHT;
-    if (strcasecmp(str.c_str(), "middle") == 0) return Position::CENTER;
-    if (strcasecmp(str.c_str(), "left") == 0) return Position::LEFT;
-    if (strcasecmp(str.c_str(), "bottom") == 0) return Position::BOTTOM;
-    if (strcasecmp(str.c_str(), "top") == 0) return Position::TOP;
-    if (strcasecmp(str.c_str(), "right") == 0) return Position::RIGHT;
-    if (strcasecmp(str.c_str(), "all") == 0) return Position::ALL;
-    throw std::runtime_error(
+    EventMask res;
+    while (!str.empty()) {
+      auto comma = str.find(',');
+      auto name  = str.substr(0, comma);
+      str.remove_prefix(comma == std::string_view::npos ? str.size()
+                                                        : comma + 1);
+      if (names::iequals(name, "all")) {
+        res.bits = ~0u;
+      } else if (auto event = names::events.find(name)) {
+        res.bits |= unsigned(*event);
+      } else {
+        return Error{
+          str_join("'", name, "' could not be parsed as an event (",
+                   names::events.names(), "|all)")};
+      }
+    }
+    return res;
+  }
+  template<>
+  auto try_parse<Predicate>(std::string_view str) -> Expected<Predicate>
+  {
+    auto colon = str.find(':');
+    auto kind  = str.substr(0, colon);
+    auto value = colon == std::string_view::npos ? "" : str.substr(colon + 1);
+    if (kind == "focus" && value.empty()) return Predicate{Predicate::Focus};
+    if (kind == "map" && !value.empty()) {
+      return Predicate{Predicate::Mapped, std::string(value)};
+    }
+    if (kind == "empty" && !value.empty()) {
+      auto ws = try_parse<int>(value);
+      if (!ws) return ws.error();
+      if (*ws < 1) return Error{"Workspaces start at 1"};
+      return Predicate{Predicate::Empty, "", std::uint32_t(*ws - 1)};
+    }
+    return Error{
       str_join("'", str,
-               "' could not be parsed as a position "
-               "(topleft|topright|bottomleft|bottomright|middle|left|bottom|"
-               "top|right|all)"));
+               "' could not be parsed as a condition "
+               "(map:<class>|focus|empty:<workspace>)")};
+  }
+  template<>
+  auto try_parse<tree::Format>(std::string_view str) -> Expected<tree::Format>
+  {
+    return lookup(names::formats, str, "a format");
+  }
+  template<>
+  auto try_parse<logging::Level>(std::string_view str) -> Expected<logging::Level>
+  {
+    return lookup(names::log_levels, str, "a log level");
   }
 
+  Expected<std::optional<Selector>> parse_selector(std::string_view str)
+  {
+    using Result = std::optional<Selector>;
+    if (str == "all") return Result(Selector{Selector::All});
+    if (str == "mapped") return Result(Selector{Selector::Mapped});
+    if (str == "under_pointer") {
+      return Result(Selector{Selector::UnderPointer});
+    }
+
+    auto colon = str.find(':');
+    if (colon == std::string_view::npos) return Result();
+    auto kind  = str.substr(0, colon);
+    auto value = str.substr(colon + 1);
+    if (kind == "id") {
+      auto window = try_parse<unsigned>(value);
+      if (!window) return window.error();
+      return Result(Selector{Selector::Id, *window});
+    }
+    if (kind == "class") {
+      return Result(Selector{Selector::Class, 0, std::string(value)});
+    }
+    if (kind == "ws") {
+      auto ws = try_parse<int>(value);
+      if (!ws) return ws.error();
+      if (*ws < 1) return Error{"Workspaces start at 1"};
+      return Result(
+        Selector{Selector::Workspace, 0, "", std::uint32_t(*ws - 1)});
+    }
+    return Result();
+  }
 
 
   // To String //
@@ -180,7 +461,7 @@ namespace ipc {
     return str;
   }
 
-  auto to_string(std::string const& str) noexcept
+  auto to_string(std::string_view str) noexcept
   {
     return str;
   }
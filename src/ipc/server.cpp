@@ -1,93 +1,487 @@
 #include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
-#include <iostream>
-#include <sstream>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <variant>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <err.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <xcb/xcb_util.h>
+#include <cctype>
 #include <csignal>
 #include <cstring>
 
+#include "binary.hpp"
 #include "handlers.hpp"
 #include "server.hpp"
 
+#include "../loop.hpp"
+#include "../state.hpp"
+
 namespace ipc {
 
-  void send_response(__pid_t dst, std::string message)
-  {
-    auto name = response_fifo_name(dst);
+  /// Storage for one request.
+  ///
+  /// Requests are parsed in place: the command and the string args are views
+  /// into `bytes`. Arenas are recycled with their capacity once the request
+  /// is done, so the message and its args don't need new buffers after the
+  /// first few requests. The job queue and the response still allocate.
+  ///
+  /// Arenas are only made and recycled on the event loop.
+  struct Arena {
+    std::vector<char> bytes;
+    std::vector<Arg> args;
 
-    // If the response pipe doesnt exist, the client is ignoring responses.
-    struct stat buf;
-    if(stat(name.c_str(), &buf) != 0) return;
+    /// Puts the arena back in `spare_arenas`, or frees it
+    struct Recycle {
+      void operator()(Arena* arena) const noexcept;
+    };
+  };
+
+  using ArenaPtr = std::unique_ptr<Arena, Arena::Recycle>;
 
-    auto stream = std::ofstream(name);
-    if (!stream.is_open()) {
-      throw std::runtime_error(str_join("Error opening response pipe: %s", strerror(errno)));
+  /// Arenas ready for reuse. Raw pointers, so nothing is destroyed at exit
+  /// while requests held by static objects still hand their arenas back.
+  constexpr std::size_t max_spare_arenas = 64;
+  static Arena* spare_arenas[max_spare_arenas];
+  static std::size_t n_spare_arenas = 0;
+  /// Arenas grown past this by unusually large requests are freed instead
+  constexpr std::size_t max_arena_size = 4096;
+
+  void Arena::Recycle::operator()(Arena* arena) const noexcept
+  {
+    if (n_spare_arenas == max_spare_arenas ||
+        arena->bytes.capacity() > max_arena_size) {
+      delete arena;
+      return;
     }
-    stream << message;
+    arena->bytes.clear();
+    arena->args.clear();
+    spare_arenas[n_spare_arenas++] = arena;
+  }
+
+  static ArenaPtr make_arena()
+  {
+    if (n_spare_arenas > 0) return ArenaPtr(spare_arenas[--n_spare_arenas]);
+    return ArenaPtr(new Arena);
   }
 
+  /// Args copied out of the request they came from, for commands that run
+  /// after it is done.
+  class StoredArgs {
+  public:
+    StoredArgs() = default;
+
+    explicit StoredArgs(Args const& args)
+    {
+      std::size_t size = 0;
+      for (std::size_t i = 0; i < args.size(); i++) {
+        if (auto* str = std::get_if<std::string_view>(&args.at(i))) {
+          size += str->size();
+        }
+      }
+      // Reserved up front, so the views stay valid while appending
+      auto& bytes = arena->bytes;
+      bytes.reserve(size);
+      for (std::size_t i = 0; i < args.size(); i++) {
+        auto& arg = args.at(i);
+        auto* str = std::get_if<std::string_view>(&arg);
+        if (str == nullptr) {
+          arena->args.push_back(arg);
+          continue;
+        }
+        auto offset = bytes.size();
+        bytes.insert(bytes.end(), str->begin(), str->end());
+        arena->args.emplace_back(
+          std::string_view(bytes.data() + offset, str->size()));
+      }
+    }
+
+    StoredArgs(StoredArgs const& other) : StoredArgs(other.view()) {}
+    StoredArgs(StoredArgs&&) noexcept = default;
+
+    StoredArgs& operator=(StoredArgs other) noexcept
+    {
+      arena = std::move(other.arena);
+      return *this;
+    }
+
+    Args view() const noexcept
+    {
+      return {arena->args.data(), arena->args.size()};
+    }
+
+  private:
+    ArenaPtr arena = make_arena();
+  };
+
   struct Request {
     __pid_t client;
-    std::string command;
-    std::vector<std::string> args;
+    /// False if the client does not want a response
+    bool reply = true;
+    /// Client chosen id, sent back with the response
+    std::optional<unsigned long> seq;
+    /// True if the request came in binary framing, and wants a binary response
+    bool binary = false;
+    /// Empty for binary requests, which only have `command_id`
+    std::string_view command;
+    /// Set directly by binary requests, otherwise parsed from `command`
+    std::optional<Command> command_id;
+    /// The windows to run a window command on, instead of the focused one
+    std::optional<Selector> selector;
+    /// The message, and the args parsed from it
+    ArenaPtr arena = make_arena();
+
+    Request() = default;
+    Request(Request&&) noexcept = default;
+    Request& operator=(Request&&) noexcept = default;
+
+    /// Copies the message, and points the copy's views into it
+    Request(Request const& other)
+      : client(other.client),
+        reply(other.reply),
+        seq(other.seq),
+        binary(other.binary),
+        command_id(other.command_id),
+        selector(other.selector)
+    {
+      auto& from   = other.arena->bytes;
+      auto& bytes  = arena->bytes;
+      bytes        = from;
+      auto rebase = [&](std::string_view view) {
+        std::less_equal<const char*> le;
+        if (from.empty() || !le(from.data(), view.data()) ||
+            !le(view.data(), from.data() + from.size())) {
+          return view;
+        }
+        return std::string_view(bytes.data() + (view.data() - from.data()),
+                                view.size());
+      };
+      command = rebase(other.command);
+      for (auto& arg : other.arena->args) {
+        auto* str = std::get_if<std::string_view>(&arg);
+        arena->args.push_back(str ? Arg(rebase(*str)) : arg);
+      }
+    }
+
+    Request& operator=(Request const& other)
+    {
+      return *this = Request(other);
+    }
+
+    /// The args, valid as long as the request
+    Args args() const noexcept
+    {
+      return {arena->args.data(), arena->args.size()};
+    }
   };
 
-  Request get_request(std::ifstream& stream)
+  /// Take the field up to `sep`, or the rest, off the front of `str`
+  static std::string_view next_field(std::string_view& str, char sep) noexcept
   {
-    std::string pid_str;
-    char c;
-    while (stream.get(c)) {
-      if (c == ':') {
-        break;
+    auto end   = str.find(sep);
+    auto field = str.substr(0, end);
+    str.remove_prefix(end == std::string_view::npos ? str.size() : end + 1);
+    return field;
+  }
+
+  /// Parse a request in the text format, from the message in its arena.
+  ///
+  /// Requests look like `pid[,flag...]:command\targ\t...\n`. Flags are
+  /// `noreply`, which tells the server not to send a response, and `seq=N`,
+  /// which tags the response with `N:`, so clients can have many requests in
+  /// flight. The command can be preceded by a selector, like
+  /// `class:Firefox\twindow_move\t10\t10`.
+  ///
+  /// Nothing is copied, the command and the args are views into the message.
+  ///
+  /// The header is stored in `res` as soon as it is parsed, so errors in the
+  /// rest of the request can still be reported according to it.
+  ///
+  /// \returns the error, if the request is malformed
+  std::optional<Error> get_request(Request& res)
+  {
+    auto& bytes = res.arena->bytes;
+    std::string_view body(bytes.data(), bytes.size());
+    body = body.substr(0, body.find('\n'));
+
+    auto colon = body.find(':');
+    if (colon == std::string_view::npos) {
+      return Error{"Error parsing message"};
+    }
+    auto header = body.substr(0, colon);
+    body.remove_prefix(colon + 1);
+
+    res.client = to_integer<__pid_t>(next_field(header, ',')).value_or(0);
+    if (res.client < 1) return Error{"Error parsing message"};
+    while (!header.empty()) {
+      auto field = next_field(header, ',');
+      if (field == "noreply") {
+        res.reply = false;
+      } else if (field.substr(0, 4) == "seq=") {
+        auto seq = to_integer<unsigned long>(field.substr(4));
+        if (!seq) return Error{"Error parsing sequence id"};
+        res.seq = *seq;
       } else {
-        pid_str += c;
+        return Error{str_join("Unknown request flag '", field, "'")};
       }
     }
-    Request res;
-    res.client = std::stoi(pid_str);
-    if (res.client < 1) {
-      throw std::runtime_error("Error parsing message");
+
+    // Fields end in a tab. The last one can also end at the newline.
+    res.command   = next_field(body, '\t');
+    auto selector = parse_selector(res.command);
+    if (!selector) return std::move(selector.error());
+    if ((res.selector = *selector)) res.command = next_field(body, '\t');
+    while (!body.empty()) {
+      res.arena->args.emplace_back(next_field(body, '\t'));
     }
+    return std::nullopt;
+  }
 
-    std::getline(stream, res.command, '\t');
-    while (stream.good()) {
-      if (stream.peek() == '\n') {
-        stream.seekg(1, std::ios::cur);
-        break;
+  /// Parse a request in the binary format, from the message in its arena.
+  /// See `binary.hpp`.
+  ///
+  /// \returns the error, if the request is malformed
+  std::optional<Error> get_binary_request(Request& res)
+  {
+    using namespace binary;
+    auto& buffer    = res.arena->bytes;
+    auto& args      = res.arena->args;
+    std::size_t pos = 0;
+    // The next `n` bytes, or null if the request ends before them
+    auto need = [&](std::size_t n) -> const char* {
+      if (buffer.size() - pos < n) return nullptr;
+      auto* data = buffer.data() + pos;
+      pos += n;
+      return data;
+    };
+    auto truncated = [] { return Error{"Truncated binary request"}; };
+
+    res.binary   = true;
+    auto* header = need(request_header_size);
+    if (header == nullptr) return truncated();
+    auto flags = read_le<std::uint8_t>(header + 1);
+    auto cmd   = read_le<std::uint16_t>(header + 2);
+    auto seq   = read_le<std::uint32_t>(header + 4);
+    res.client = read_le<std::uint32_t>(header + 8);
+    res.reply  = (flags & NoReply) == 0;
+    if (flags & Seq) res.seq = seq;
+
+    if (cmd >= n_commands) return Error{str_join("No command has id ", cmd)};
+    res.command_id = static_cast<Command>(cmd);
+
+    auto argc = read_le<std::uint8_t>(header + 12);
+    args.reserve(argc);
+    for (int i = 0; i < argc; i++) {
+      auto* type = need(1);
+      if (type == nullptr) return truncated();
+      switch (static_cast<ArgType>(read_le<std::uint8_t>(type))) {
+      case ArgType::Int: {
+        auto* value = need(8);
+        if (value == nullptr) return truncated();
+        args.emplace_back(long(read_le<std::int64_t>(value)));
+      } break;
+      case ArgType::String: {
+        auto* len = need(2);
+        if (len == nullptr) return truncated();
+        auto size   = read_le<std::uint16_t>(len);
+        auto* value = need(size);
+        if (value == nullptr) return truncated();
+        args.emplace_back(std::string_view(value, size));
+      } break;
+      default: return Error{"Unknown argument type"};
       }
-      res.args.emplace_back();
-      std::getline(stream, res.args.back(), '\t');
     }
-    return res;
+
+    if (flags & Select) {
+      auto* sel =
+        args.empty() ? nullptr : std::get_if<std::string_view>(&args[0]);
+      if (sel == nullptr) return Error{"Expected a selector"};
+      auto selector = parse_selector(*sel);
+      if (!selector) return std::move(selector.error());
+      if (!(res.selector = *selector)) return Error{"Expected a selector"};
+      args.erase(args.begin());
+    }
+    return std::nullopt;
+  }
+
+  /// Parse the message in the arena of the request, in either format.
+  ///
+  /// \returns the error, if the request is malformed
+  std::optional<Error> parse_message(Request& res)
+  {
+    auto& bytes = res.arena->bytes;
+    if (!bytes.empty() && std::uint8_t(bytes[0]) == binary::magic) {
+      return get_binary_request(res);
+    }
+    return get_request(res);
+  }
+
+  /// Copy a message into the arena of the request, and parse it.
+  std::optional<Error> parse_message(std::string_view message, Request& res)
+  {
+    res.arena->bytes.assign(message.begin(), message.end());
+    return parse_message(res);
   }
 
   /// Automatically construct array of handlers from enum.
   namespace detail {
-    template<Command cmd>
-    constexpr auto get_handler() -> function_ptr<std::string, Args>
+    template<typename T>
+    struct is_optional : std::false_type {};
+    template<typename T>
+    struct is_optional<std::optional<T>> : std::true_type {};
+
+    template<typename T>
+    struct is_expected : std::false_type {};
+    template<typename T>
+    struct is_expected<Expected<T>> : std::true_type {};
+
+    using Handler = function_ptr<Expected<std::string>, Args>;
+    using Checker = function_ptr<std::optional<Error>, Args>;
+
+    /// Parse arg `i` for a parameter of type `T`. Missing optional args are
+    /// left empty, the arity was checked already.
+    template<typename T>
+    Expected<T> parse_param(Args const& args, std::size_t i)
+    {
+      if constexpr (is_optional<T>::value) {
+        if (i >= args.size()) return T{};
+        auto res = try_parse<typename T::value_type>(args.at(i));
+        if (!res) return res.error();
+        return T(std::move(*res));
+      } else {
+        return try_parse<T>(args.at(i));
+      }
+    }
+
+    /// Run a handler, and turn what it returns into the response
+    template<typename F>
+    Expected<std::string> respond(F&& run)
+    {
+      using Ret = decltype(run());
+      if constexpr (std::is_void_v<Ret>) {
+        run();
+        return std::string{};
+      } else if constexpr (is_expected<Ret>::value) {
+        return run();
+      } else {
+        return to_string(run());
+      }
+    }
+
+    template<Command cmd, typename... Params, std::size_t... Idxs>
+    Expected<std::string> call_parsed(Args const& args,
+                                      std::index_sequence<Idxs...>)
+    {
+      std::tuple<Expected<Params>...> parsed{
+        parse_param<Params>(args, Idxs)...};
+      Error* error = nullptr;
+      ((error = error == nullptr && !std::get<Idxs>(parsed)
+                  ? &std::get<Idxs>(parsed).error()
+                  : error),
+       ...);
+      if (error != nullptr) return std::move(*error);
+      return respond(
+        [&] { return handler(For<cmd>{}, std::move(*std::get<Idxs>(parsed))...); });
+    }
+
+    /// The error for `count` args, if the parameters don't take that many
+    template<Command cmd, typename... Params>
+    std::optional<Error> check_arity(std::size_t count)
+    {
+      constexpr std::size_t max = sizeof...(Params);
+      constexpr std::size_t min = (0 + ... + !is_optional<Params>::value);
+      if (count >= min && count <= max) return std::nullopt;
+      return Error{str_join(
+        names::commands.name_of(cmd), " takes ",
+        min == max ? std::to_string(min) : str_join(min, " to ", max),
+        max == 1 ? " argument" : " arguments", ", not ", count)};
+    }
+
+    template<typename... Params, std::size_t... Idxs>
+    std::optional<Error> check_parsed(Args const& args,
+                                      std::index_sequence<Idxs...>)
+    {
+      std::optional<Error> error;
+      // Unused by commands without parameters
+      [[maybe_unused]] auto check = [&](auto parsed) {
+        if (!error && !parsed) error = std::move(parsed.error());
+      };
+      (check(parse_param<Params>(args, Idxs)), ...);
+      return error;
+    }
+
+    /// Wrap the handler, counting and parsing its args first, as declared by
+    /// its parameters. `Params` are deduced from the one `handler` overload
+    /// that takes `For<cmd>`.
+    template<Command cmd, typename Ret, typename... Params>
+    constexpr auto make_handler(Ret (*)(For<cmd>, Params...)) -> Handler
     {
-      using Ret = decltype(handler(For<cmd>(), std::declval<Args>()));
-      return [](Args args) {
-        if constexpr (std::is_void_v<Ret>) {
-          handler(For<cmd>{}, std::move(args));
-          return std::string{};
+      return [](Args args) -> Expected<std::string> {
+        if constexpr (std::is_same_v<std::tuple<Params...>, std::tuple<Args>>) {
+          return respond([&] { return handler(For<cmd>{}, args); });
         } else {
-          auto res = handler(For<cmd>{}, std::move(args));
-          return to_string(std::move(res));
+          if (auto error = check_arity<cmd, Params...>(args.size())) {
+            return std::move(*error);
+          }
+          return call_parsed<cmd, Params...>(
+            args, std::index_sequence_for<Params...>());
         }
       };
     }
 
+    /// Count and parse the args like `make_handler`, without running the
+    /// handler. Handlers taking `Args` check them as they run.
+    template<Command cmd, typename Ret, typename... Params>
+    constexpr auto make_checker(Ret (*)(For<cmd>, Params...)) -> Checker
+    {
+      return [](Args args) -> std::optional<Error> {
+        if constexpr (std::is_same_v<std::tuple<Params...>, std::tuple<Args>>) {
+          return std::nullopt;
+        } else {
+          if (auto error = check_arity<cmd, Params...>(args.size())) {
+            return error;
+          }
+          return check_parsed<Params...>(
+            args, std::index_sequence_for<Params...>());
+        }
+      };
+    }
+
+    template<Command cmd>
+    constexpr auto get_handler() -> Handler
+    {
+      return make_handler<cmd>(&handler);
+    }
+
+    template<Command cmd>
+    constexpr auto get_checker() -> Checker
+    {
+      return make_checker<cmd>(&handler);
+    }
+
     template<std::size_t... idxs>
     constexpr auto get_handlers(std::index_sequence<idxs...>)
     {
-      std::array<function_ptr<std::string, Args>, n_commands> arr = {};
-      return std::array<function_ptr<std::string, Args>, n_commands>{
+      return std::array<Handler, n_commands>{
         get_handler<static_cast<Command>(idxs)>()...};
     }
 
@@ -96,99 +490,1427 @@ namespace ipc {
       return get_handlers(std::make_index_sequence<n_commands>());
     }
 
+    template<std::size_t... idxs>
+    constexpr auto get_checkers(std::index_sequence<idxs...>)
+    {
+      return std::array<Checker, n_commands>{
+        get_checker<static_cast<Command>(idxs)>()...};
+    }
+
+    constexpr auto get_checkers()
+    {
+      return get_checkers(std::make_index_sequence<n_commands>());
+    }
+
   } // namespace detail
 
 
+  /// Whether a command only reads the state, so the snapshot queries are
+  /// answered from stays valid
+  static bool is_query(Command cmd)
+  {
+    switch (cmd) {
+    case Command::GetFocused:
+    case Command::GetTree:
+    case Command::Subscribe:
+    case Command::WaitFor:
+    case Command::Begin:
+    case Command::Commit:
+    case Command::LogLevel: return true;
+    default: return false;
+    }
+  }
+
   /// Call the handler for a command.
   ///
-  /// \throws `std::runtime_error` if no handler was found
-  auto call_handler(Command cmd, Args args)
+  /// \returns the response, or an error if the args don't fit the command
+  /// \throws if the handler fails
+  Expected<std::string> call_handler(Command cmd, Args args)
   {
     static constexpr auto handlers = detail::get_handlers();
-    return handlers.at(static_cast<std::size_t>(cmd))(std::move(args));
+    if (!is_query(cmd)) tree::invalidate();
+    return handlers.at(static_cast<std::size_t>(cmd))(args);
+  }
+
+  /// Check the args of a command that runs later, so mistakes show up when
+  /// it is scheduled or defined, and not only in the log.
+  ///
+  /// \returns the error, if the args don't fit the command
+  static std::optional<Error> check_args(Command cmd, Args args)
+  {
+    static constexpr auto checkers = detail::get_checkers();
+    return checkers.at(static_cast<std::size_t>(cmd))(args);
   }
 
 
-  static auto name = request_fifo_name();
-  static bool halt = false;
+  /// Run a window command for each window matching `sel`, flushing the X
+  /// connection once at the end.
+  ///
+  /// \returns the non empty responses, one per line, or the first error
+  Expected<std::string> run_selected(Selector const& sel,
+                                     Command cmd,
+                                     Args const& args)
+  {
+    if (!takes_selector(cmd)) {
+      return Error{"This command does not take a selector"};
+    }
+    std::string res;
+    xcb::FlushBatch batch;
+    for (auto window : select(sel)) {
+      // An earlier run can have closed the window
+      selected = wm::find_client(window);
+      if (selected == nullptr) continue;
+      Expected<std::string> out = std::string();
+      try {
+        out = call_handler(cmd, args);
+      } catch (...) {
+        selected = nullptr;
+        throw;
+      }
+      if (!out) {
+        selected = nullptr;
+        return out;
+      }
+      if (out->empty()) continue;
+      if (!res.empty()) res += '\n';
+      res += *out;
+    }
+    selected = nullptr;
+    return res;
+  }
+
+  /// A parsed command, as stored by macros
+  struct Step {
+    std::optional<Selector> selector;
+    Command cmd;
+    StoredArgs args;
+  };
+
+  static std::map<std::string, std::vector<Step>, std::less<>> macros;
+  /// Number of macros being run, to stop runaway recursion
+  static int macro_depth        = 0;
+  constexpr int max_macro_depth = 16;
+
+  /// Numbers are stored as such, so handlers don't parse them every run.
+  /// Anything else, including enum names, stays a string.
+  static Arg pre_parse(std::string_view str)
+  {
+    if (auto num = to_integer<long>(str)) return *num;
+    return str;
+  }
+
+  void define_macro(std::string_view name, Args const& args)
+  {
+    // Names that parse as selectors could never be run
+    auto selector = parse_selector(name);
+    if (names::commands.find(name) || name.empty() || !selector ||
+        *selector) {
+      throw std::runtime_error(str_join("Invalid macro name '", name, "'"));
+    }
+
+    // Text requests have the commands as words, or as one string when the
+    // script quoted them. Either way, split on whitespace and `;`.
+    // The words are views into the args, until the steps copy them.
+    std::vector<std::vector<Arg>> commands(1);
+    for (std::size_t i = 0; i < args.size(); i++) {
+      auto& arg = args.at(i);
+      auto* str = std::get_if<std::string_view>(&arg);
+      if (str == nullptr) {
+        commands.back().push_back(arg);
+        continue;
+      }
+      std::size_t start = 0;
+      for (std::size_t j = 0; j <= str->size(); j++) {
+        char c = j < str->size() ? (*str)[j] : ' ';
+        if (c != ';' && !std::isspace(static_cast<unsigned char>(c))) continue;
+        if (j > start) {
+          commands.back().push_back(pre_parse(str->substr(start, j - start)));
+        }
+        start = j + 1;
+        if (c == ';') commands.emplace_back();
+      }
+    }
+
+    std::vector<Step> steps;
+    for (auto& command : commands) {
+      if (command.empty()) continue;
+      std::size_t word = 0;
+      Step step;
+      if (auto* str = std::get_if<std::string_view>(&command[word])) {
+        if ((step.selector = parse_selector(*str).value())) ++word;
+      }
+      if (word == command.size()) {
+        throw std::runtime_error("Expected a command after the selector");
+      }
+      // Numbers were pre parsed, and are never command names
+      auto* cmd_name = std::get_if<std::string_view>(&command[word++]);
+      if (cmd_name == nullptr) {
+        throw std::runtime_error("Expected a command name");
+      }
+      step.cmd = parse<Command>(*cmd_name);
+      if (step.selector && !takes_selector(step.cmd)) {
+        throw std::runtime_error("This command does not take a selector");
+      }
+      // Their response, or their effect, belongs to a request of their own
+      switch (step.cmd) {
+      case Command::Subscribe:
+      case Command::WaitFor:
+      case Command::Begin:
+      case Command::Commit:
+        throw std::runtime_error(
+          str_join(names::commands.name_of(step.cmd),
+                   " can't be part of a macro"));
+      default: break;
+      }
+      Args step_args{command.data() + word, command.size() - word};
+      if (auto error = check_args(step.cmd, step_args)) {
+        throw std::runtime_error(error->message);
+      }
+      step.args = StoredArgs(step_args);
+      steps.push_back(std::move(step));
+    }
+    if (steps.empty()) {
+      throw std::runtime_error(str_join("Macro '", name, "' has no commands"));
+    }
+    macros[std::string(name)] = std::move(steps);
+  }
+
+  Expected<std::string> run_macro(std::string_view name)
+  {
+    auto macro = macros.find(name);
+    if (macro == macros.end()) {
+      return Error{str_join("No macro named '", name, "'")};
+    }
+    if (macro_depth >= max_macro_depth) {
+      return Error{str_join("Macro '", name, "' nests too deep")};
+    }
+
+    // A copy, the macro can be redefined by its own commands
+    auto steps = macro->second;
+    std::string res;
+    xcb::FlushBatch batch;
+    macro_depth++;
+    try {
+      for (auto& step : steps) {
+        auto out = step.selector
+                     ? run_selected(*step.selector, step.cmd, step.args.view())
+                     : call_handler(step.cmd, step.args.view());
+        if (!out) {
+          macro_depth--;
+          return out;
+        }
+        if (out->empty()) continue;
+        if (!res.empty()) res += '\n';
+        res += *out;
+      }
+    } catch (...) {
+      macro_depth--;
+      throw;
+    }
+    macro_depth--;
+    return res;
+  }
+
+  /// Log, and run the request.
+  ///
+  /// \returns the response, or an error if the request is wrong
+  /// \throws if the handler fails
+  Expected<std::string> run_request(Request& req)
+  {
+    if (logging::enabled(logging::Level::Info)) {
+      logging::Line line(logging::Level::Info);
+      line << "Recieved command from " << req.client << ": ";
+      if (req.binary) {
+        line << names::commands.name_of(*req.command_id);
+      } else {
+        line << req.command;
+      }
+      line << " [ ";
+      for (auto& arg : req.arena->args) {
+        std::visit([&](auto& val) { line << val << ' '; }, arg);
+      }
+      line << ']';
+    }
+
+    // Macros can be run by name. They can't shadow commands.
+    if (!req.command_id && macros.find(req.command) != macros.end()) {
+      return run_macro(req.command);
+    }
+    auto cmd = req.command_id ? Expected<Command>(*req.command_id)
+                              : try_parse<Command>(req.command);
+    if (!cmd) return cmd.error();
+    if (req.selector) {
+      return run_selected(*req.selector, *cmd, req.args());
+    }
+    return call_handler(*cmd, req.args());
+  }
+
+  /// Frame the response for the request.
+  ///
+  /// Text responses are prefixed with the sequence id of the request, if it
+  /// has one, and always end in a newline, so an empty response is never an
+  /// empty packet.
+  ///
+  /// The response is framed in place, so large ones, like `get_tree`, are not
+  /// copied when moved in.
+  std::string format_response(Request const& req,
+                              std::string response,
+                              binary::Status status = binary::Status::Ok)
+  {
+    std::string header;
+    if (req.binary) {
+      using namespace binary;
+      write_le<std::uint8_t>(header, magic);
+      write_le<std::uint8_t>(header, std::uint8_t(status));
+      write_le<std::uint32_t>(header, req.seq.value_or(0));
+    } else {
+      if (req.seq) header = str_join(*req.seq, ":");
+      if (status == binary::Status::Error) header += "Error: ";
+      response += '\n';
+    }
+    response.insert(0, header);
+    return response;
+  }
+
+  /// Take the response out of a result, logging errors
+  ///
+  /// \returns the status to send the response with
+  static binary::Status unpack(Expected<std::string> res, std::string& response)
+  {
+    if (res) {
+      response = std::move(*res);
+      return binary::Status::Ok;
+    }
+    LOG(Error) << "Error: " << res.error().message;
+    response = std::move(res.error().message);
+    return binary::Status::Error;
+  }
+
+  static void check_waiters();
+
+  std::optional<std::string> handle_message(std::string_view message)
+  {
+    Request req;
+    std::string response;
+    auto status = binary::Status::Ok;
+    try {
+      auto error = parse_message(message, req);
+      status     = unpack(error ? Expected<std::string>(std::move(*error))
+                                : run_request(req),
+                          response);
+      check_waiters();
+    } catch (std::exception& e) {
+      LOG(Error) << "Error: " << e.what();
+      response = e.what();
+      status   = binary::Status::Error;
+    }
+    if (!req.reply) return std::nullopt;
+    return format_response(req, std::move(response), status);
+  }
+
+  bool load_config(const char* path)
+  {
+    auto stream = std::ifstream(path);
+    if (!stream.is_open()) return false;
+
+    unsigned effects = NoEffects;
+    std::string line;
+    std::vector<Arg> args;
+    for (int line_nr = 1; std::getline(stream, line); line_nr++) {
+      std::string_view rest(line);
+      rest = rest.substr(0, rest.find('#'));
+      args.clear();
+      while (true) {
+        auto start = rest.find_first_not_of(" \t\r");
+        if (start == std::string_view::npos) break;
+        auto end = std::min(rest.find_first_of(" \t\r", start), rest.size());
+        args.emplace_back(rest.substr(start, end - start));
+        rest.remove_prefix(end);
+      }
+      if (args.empty()) continue;
+
+      auto res = set_config(Args{args.data(), args.size()});
+      if (res) {
+        effects |= *res;
+      } else {
+        LOG(Error) << path << ':' << line_nr << ": " << res.error().message;
+      }
+    }
+    apply_config(effects);
+    return true;
+  }
+
+  /// Identifies a connection to the socket. Unlike its descriptor, an id is
+  /// never reused, so a waiter that completes after its client left can't
+  /// respond to the next one.
+  using ConnId = std::uint64_t;
+  /// The connection of requests from the fifo, and the X connection
+  constexpr ConnId no_connection = 0;
+
+  /// A request, with the connection its response goes to
+  struct Queued {
+    ConnId conn;
+    Request req;
+    /// Set if the request couldn't be parsed, and is only answered with it
+    std::optional<std::string> error = {};
+  };
+
+  /// Requests read during one wakeup of the loop, run in order once all
+  /// ready descriptors were read, see `run_requests`
+  struct Job {
+    enum Kind {
+      /// Run the first request. The others were merged into it, see
+      /// `merge_delta`, and get the same response.
+      Run,
+      /// Run the last request, a `commit`, with the others as its transaction
+      Commit,
+      /// Respond with `error`, the request couldn't be parsed. Queued like
+      /// the others, so responses stay in order.
+      Fail,
+      /// The connection `closed` is gone, forget its subscriptions and waiters
+      Close,
+    } kind;
+    std::vector<Queued> requests = {};
+    std::string error = {};
+    ConnId closed = no_connection;
+  };
+
+  /// A connection subscribed to events
+  struct Subscriber {
+    ConnId conn;
+    EventMask mask;
+    /// The subscribe request. Events are framed like responses to it.
+    Request request;
+    /// Events waiting to be moved to the outbox of the connection
+    std::deque<std::string> events;
+    /// Number of events dropped since the last one sent
+    std::size_t dropped = 0;
+  };
+
+  /// A connection waiting for a predicate to hold
+  struct Waiter {
+    ConnId conn;
+    Predicate pred;
+    /// The wait_for request, which is responded to when `pred` holds
+    Request request;
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+  };
+
+  /// A client connected to the socket
+  struct Connection {
+    int fd;
+    ConnId id;
+    /// Responses waiting for the socket to become writable
+    std::deque<std::string> outbox;
+    /// Requests queued between `begin` and `commit`
+    std::optional<std::vector<Queued>> transaction;
+    /// Whether the loop watches the socket for room in its buffer
+    bool waiting_to_write = false;
+    /// Responses dropped because the outbox was full. The client can't tell
+    /// which, so the connection is closed by `send_responses`.
+    std::size_t dropped = 0;
+  };
+
+  /// A response on its way to a client of the request fifo.
+  ///
+  /// The response fifo is opened without blocking, which fails until the
+  /// client opens it for reading, so a client that died before doing so
+  /// can't hold up the loop.
+  struct FifoResponse {
+    std::string name;
+    std::string data;
+    std::chrono::steady_clock::time_point deadline;
+    int fd              = -1;
+    std::size_t written = 0;
+    /// Whether the loop watches `fd` for room in the fifo
+    bool watched = false;
+  };
+
+  /// Events queued per subscriber, before new ones are dropped
+  constexpr std::size_t max_queued_events = 256;
+  /// Responses queued per connection, before the client is considered stuck
+  /// and disconnected
+  constexpr std::size_t max_queued_responses = 256;
+  /// How long a client of the request fifo has to open its response fifo
+  /// and read the response, before the response is dropped
+  constexpr auto response_timeout = std::chrono::seconds(1);
+  /// How often to retry opening a response fifo that has no reader yet
+  constexpr int response_retry_ms = 1;
+
+  static auto name        = request_fifo_name();
+  static int listen_fd    = -1;
+  static int fifo_fd      = -1;
+  static Transport active = Transport::Socket;
+
+  /// Sorted by id, as ids only grow
+  static std::vector<Connection> connections;
+  static ConnId last_conn_id = no_connection;
+  static std::vector<FifoResponse> fifo_responses;
+  /// Responses that couldn't be delivered in time, or at all
+  static std::size_t dropped_responses = 0;
+
+  /// Read since the last `run_requests`
+  static std::vector<Job> pending;
+
+  /// The request being run, if it came from a client
+  static ConnId current_conn      = no_connection;
+  static Request* current_request = nullptr;
+  /// Set when the current request is responded to later, by a waiter
+  static bool current_deferred = false;
+  /// The requests of the transaction being committed
+  static std::vector<Queued>* current_transaction = nullptr;
+  /// Set while a `begin` or `commit` read from the socket runs. Only those
+  /// open and close transactions, see `read_requests`. Anywhere else, like
+  /// in a macro or a scheduled command, they would do nothing.
+  static bool current_boundary = false;
+
+  static std::vector<Subscriber> subscribers;
+  static std::vector<Waiter> waiters;
+  /// Union of all events listened to, so `notify` can return right away
+  /// when nobody listens
+  static unsigned subscribed_events = 0;
+
+  static Connection* find_connection(ConnId id)
+  {
+    auto conn = std::lower_bound(
+      connections.begin(), connections.end(), id,
+      [](auto& conn, ConnId id) { return conn.id < id; });
+    if (conn == connections.end() || conn->id != id || conn->fd < 0) {
+      return nullptr;
+    }
+    return &*conn;
+  }
+
+  /// Queue a response, to be sent by `send_responses`, once the changes it
+  /// reports were flushed to the X server. Responses to a connection that
+  /// is gone, or has `max_queued_responses` waiting already, are dropped.
+  static void post(ConnId conn,
+                   Request const& req,
+                   std::string response,
+                   binary::Status status = binary::Status::Ok)
+  {
+    if (!req.reply) return;
+    auto data = format_response(req, std::move(response), status);
+    if (conn != no_connection) {
+      if (auto* connection = find_connection(conn)) {
+        if (connection->outbox.size() >= max_queued_responses) {
+          connection->dropped++;
+          dropped_responses++;
+          return;
+        }
+        connection->outbox.push_back(std::move(data));
+      }
+      return;
+    }
+    auto name = response_fifo_name(req.client);
+    // If the response pipe doesnt exist, the client is ignoring responses.
+    struct stat buf;
+    if (stat(name.c_str(), &buf) != 0) return;
+    fifo_responses.push_back({std::move(name), std::move(data),
+                              std::chrono::steady_clock::now() +
+                                response_timeout});
+  }
+
+  /// Events after which `pred` can start to hold
+  static unsigned events_for(Predicate const& pred)
+  {
+    switch (pred.kind) {
+    case Predicate::Mapped: return unsigned(Event::Map);
+    case Predicate::Focus: return unsigned(Event::Focus);
+    case Predicate::Empty:
+      return unsigned(Event::Unmap) | unsigned(Event::Destroy);
+    }
+    return 0;
+  }
 
-  void run()
+  /// Recompute `subscribed_events`
+  static void update_subscribed_events()
+  {
+    unsigned bits = 0;
+    for (auto& sub : subscribers) bits |= sub.mask.bits;
+    for (auto& waiter : waiters) bits |= events_for(waiter.pred);
+    subscribed_events = bits;
+  }
+
+  /// Respond to the waiters whose predicate holds
+  static void complete_waiters()
+  {
+    bool completed = false;
+    for (auto it = waiters.begin(); it != waiters.end();) {
+      auto res = check(it->pred);
+      if (!res) {
+        ++it;
+        continue;
+      }
+      post(it->conn, it->request, std::move(*res));
+      it        = waiters.erase(it);
+      completed = true;
+    }
+    if (completed) update_subscribed_events();
+  }
+
+  /// Check the waiters after a command
+  static void check_waiters()
+  {
+    if (subscribed_events == 0) return;
+    complete_waiters();
+  }
+
+  void wait_for(Predicate pred,
+                std::optional<std::chrono::milliseconds> timeout)
+  {
+    if (current_conn == no_connection || current_request == nullptr) {
+      throw std::runtime_error("Waiting is only supported on the socket");
+    }
+    // The macro responds once, with the responses of all its commands
+    if (macro_depth > 0) {
+      throw std::runtime_error("Waiting is not supported in macros");
+    }
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    if (timeout) deadline = std::chrono::steady_clock::now() + *timeout;
+
+    waiters.push_back(
+      {current_conn, std::move(pred), *current_request, deadline});
+    update_subscribed_events();
+    current_deferred = true;
+  }
+
+  /// Respond with an error to waiters whose deadline passed.
+  ///
+  /// \returns the time until the next deadline, in the format of `poll`
+  static int expire_waiters()
+  {
+    using namespace std::chrono;
+    auto now     = steady_clock::now();
+    int next     = -1;
+    bool expired = false;
+    for (auto it = waiters.begin(); it != waiters.end();) {
+      if (!it->deadline) {
+        ++it;
+      } else if (*it->deadline <= now) {
+        post(it->conn, it->request, "Timed out", binary::Status::Error);
+        it      = waiters.erase(it);
+        expired = true;
+      } else {
+        // Round up, so poll doesn't wake up right before the deadline
+        int left = duration_cast<milliseconds>(*it->deadline - now).count() + 1;
+        if (next < 0 || left < next) next = left;
+        ++it;
+      }
+    }
+    if (expired) update_subscribed_events();
+    return next;
+  }
+
+  void subscribe(EventMask mask)
+  {
+    if (current_conn == no_connection || current_request == nullptr) {
+      throw std::runtime_error("Subscribing is only supported on the socket");
+    }
+    if (macro_depth > 0) {
+      throw std::runtime_error("Subscribing is not supported in macros");
+    }
+    auto sub = std::find_if(subscribers.begin(), subscribers.end(),
+                            [](auto& sub) { return sub.conn == current_conn; });
+    if (sub == subscribers.end()) {
+      subscribers.push_back({current_conn, mask, *current_request, {}, 0});
+    } else {
+      sub->mask    = mask;
+      sub->request = *current_request;
+    }
+    update_subscribed_events();
+  }
+
+  void notify(Event event, std::string const& data)
+  {
+    if ((subscribed_events & static_cast<unsigned>(event)) == 0) return;
+    auto text = str_join(names::events.name_of(event), " ", data);
+    for (auto& sub : subscribers) {
+      if (!sub.mask.has(event)) continue;
+      if (sub.events.size() >= max_queued_events) {
+        sub.dropped++;
+        continue;
+      }
+      sub.events.push_back(
+        format_response(sub.request, text, binary::Status::Event));
+    }
+    complete_waiters();
+  }
+
+  /// Move the events queued for a connection to its outbox.
+  ///
+  /// Events are only moved once the outbox is empty, so a client that doesn't
+  /// read holds at most `max_queued_events` events in memory. Events are only
+  /// dropped once the queue is full, so a `dropped N` event goes after the
+  /// queued ones.
+  static void take_events(std::deque<std::string>& outbox, ConnId conn)
+  {
+    if (!outbox.empty()) return;
+    for (auto& sub : subscribers) {
+      if (sub.conn != conn) continue;
+      outbox.insert(outbox.end(), std::make_move_iterator(sub.events.begin()),
+                    std::make_move_iterator(sub.events.end()));
+      sub.events.clear();
+      if (sub.dropped > 0) {
+        outbox.push_back(format_response(
+          sub.request, str_join("dropped ", sub.dropped), binary::Status::Event));
+        sub.dropped = 0;
+      }
+    }
+  }
+
+  /// Forget the subscriptions and waiters of a closed connection
+  static void unsubscribe(ConnId conn)
+  {
+    subscribers.erase(
+      std::remove_if(subscribers.begin(), subscribers.end(),
+                     [conn](auto& sub) { return sub.conn == conn; }),
+      subscribers.end());
+    waiters.erase(
+      std::remove_if(waiters.begin(), waiters.end(),
+                     [conn](auto& waiter) { return waiter.conn == conn; }),
+      waiters.end());
+    update_subscribed_events();
+  }
+
+  /// A command scheduled with `after` or `every`
+  struct Timer {
+    unsigned id;
+    std::chrono::steady_clock::time_point next;
+    /// Zero unless the command repeats
+    std::chrono::milliseconds interval;
+    Command cmd;
+    StoredArgs args;
+  };
+
+  static std::vector<Timer> timers;
+  static unsigned last_timer_id = 0;
+  /// So a looping client can't grow the list without bound
+  constexpr std::size_t max_timers = 256;
+  /// Armed for the earliest timer, and watched by the loop
+  static int timer_fd = -1;
+
+  /// Arm `timer_fd` for the earliest timer, or disarm it if there is none
+  static void arm_timer()
+  {
+    itimerspec spec = {};
+    auto next = std::min_element(timers.begin(), timers.end(),
+                                 [](auto& a, auto& b) { return a.next < b.next; });
+    if (next != timers.end()) {
+      // steady_clock is CLOCK_MONOTONIC
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  next->next.time_since_epoch())
+                  .count();
+      // A zero value disarms the timer
+      spec.it_value.tv_sec  = ns / 1000000000;
+      spec.it_value.tv_nsec = std::max<long>(ns % 1000000000, 1);
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+  }
+
+  Expected<unsigned> schedule(std::chrono::milliseconds delay,
+                              bool repeat,
+                              Command cmd,
+                              Args args)
+  {
+    if (timer_fd < 0) {
+      throw std::runtime_error("Scheduling needs the event loop to run");
+    }
+    if (auto error = check_args(cmd, args)) return std::move(*error);
+    if (timers.size() >= max_timers) {
+      return Error{
+        str_join("Too many scheduled commands, the limit is ", max_timers)};
+    }
+    auto id = ++last_timer_id;
+    timers.push_back({id, std::chrono::steady_clock::now() + delay,
+                      repeat ? delay : std::chrono::milliseconds(0), cmd,
+                      StoredArgs(args)});
+    arm_timer();
+    return id;
+  }
+
+  bool cancel(unsigned id)
+  {
+    auto timer = std::find_if(timers.begin(), timers.end(),
+                              [id](auto& timer) { return timer.id == id; });
+    if (timer == timers.end()) return false;
+    timers.erase(timer);
+    arm_timer();
+    return true;
+  }
+
+  /// Run the commands that are due
+  static void run_timers()
+  {
+    std::uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0) return;
+
+    auto now = std::chrono::steady_clock::now();
+    // Commands can schedule and cancel timers, so take the due ones first
+    std::vector<std::pair<Command, StoredArgs>> due;
+    for (auto it = timers.begin(); it != timers.end();) {
+      if (it->next > now) {
+        ++it;
+        continue;
+      }
+      due.emplace_back(it->cmd, it->args);
+      if (it->interval.count() == 0) {
+        it = timers.erase(it);
+        continue;
+      }
+      // Skip the runs that were missed instead of catching up
+      it->next += it->interval;
+      if (it->next <= now) it->next = now + it->interval;
+      ++it;
+    }
+    xcb::FlushBatch batch;
+    for (auto& [cmd, args] : due) {
+      try {
+        auto res = call_handler(cmd, args.view());
+        if (!res) {
+          LOG(Error) << "Error in scheduled command: " << res.error().message;
+        }
+      } catch (std::exception& e) {
+        LOG(Error) << "Error in scheduled command: " << e.what();
+      }
+    }
+    arm_timer();
+    check_waiters();
+  }
+
+  /// Run a request, and respond to it and to the requests merged into it,
+  /// unless it waits to respond later.
+  static void run_queued(Queued* queued, std::size_t count)
+  {
+    auto& req = queued[0].req;
+    std::string response;
+    auto status     = binary::Status::Ok;
+    current_conn    = queued[0].conn;
+    current_request = &req;
+    try {
+      status = unpack(run_request(req), response);
+    } catch (std::exception& e) {
+      LOG(Error) << "Error: " << e.what();
+      response = e.what();
+      status   = binary::Status::Error;
+    }
+    current_conn    = no_connection;
+    current_request = nullptr;
+    if (current_deferred) {
+      current_deferred = false;
+      return;
+    }
+    for (std::size_t i = 0; i < count; i++) {
+      post(queued[i].conn, queued[i].req, response, status);
+    }
+  }
+
+  /// A response produced on the worker thread
+  struct Work {
+    ConnId conn;
+    Request request;
+    std::function<std::string()> run;
+    std::string response = {};
+    binary::Status status = binary::Status::Ok;
+  };
+
+  /// Serializes big responses off the loop. The lock is only held to move
+  /// work in and out, never while it runs. Work is passed by pointer, so its
+  /// request, and the arena of it, are only made and freed on the loop.
+  struct Worker {
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::unique_ptr<Work>> inbox;
+    std::vector<std::unique_ptr<Work>> done;
+    /// Signaled when work is done, and watched by the loop
+    int done_fd = -1;
+  };
+
+  /// Started by the first deferred response. Never stopped, it idles until
+  /// the process exits.
+  static Worker* worker = nullptr;
+
+  static void run_worker(Worker& w)
+  {
+    while (true) {
+      std::unique_ptr<Work> work;
+      {
+        std::unique_lock lock(w.lock);
+        w.wake.wait(lock, [&] { return !w.inbox.empty(); });
+        work = std::move(w.inbox.front());
+        w.inbox.pop_front();
+      }
+      try {
+        work->response = work->run();
+      } catch (std::exception& e) {
+        work->response = e.what();
+        work->status   = binary::Status::Error;
+      }
+      // Drops what it captured here, rather than on the loop
+      work->run = nullptr;
+      {
+        std::lock_guard lock(w.lock);
+        w.done.push_back(std::move(work));
+      }
+      std::uint64_t one = 1;
+      while (write(w.done_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    }
+  }
+
+  /// Post the responses the worker finished
+  static void collect_work()
+  {
+    std::uint64_t count;
+    if (read(worker->done_fd, &count, sizeof(count)) < 0) return;
+    std::vector<std::unique_ptr<Work>> done;
+    {
+      std::lock_guard lock(worker->lock);
+      done.swap(worker->done);
+    }
+    for (auto& work : done) {
+      if (work->status == binary::Status::Error) {
+        LOG(Error) << "Error: " << work->response;
+      }
+      post(work->conn, work->request, std::move(work->response),
+           work->status);
+    }
+  }
+
+  bool respond_later(std::function<std::string()> work)
+  {
+    // Macros and client messages need the response right away. Without a
+    // sequence id, or in a transaction, responses must stay in order.
+    if (current_request == nullptr || macro_depth > 0 ||
+        !current_request->seq || current_transaction != nullptr) {
+      return false;
+    }
+    if (worker == nullptr) {
+      worker          = new Worker;
+      worker->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+      if (worker->done_fd < 0) {
+        errx(EXIT_FAILURE, "Error creating eventfd: %s", strerror(errno));
+      }
+      loop::add(worker->done_fd, EPOLLIN,
+                [](std::uint32_t) { collect_work(); });
+      std::thread(run_worker, std::ref(*worker)).detach();
+    }
+    {
+      std::lock_guard lock(worker->lock);
+      worker->inbox.push_back(std::make_unique<Work>(
+        Work{current_conn, *current_request, std::move(work)}));
+    }
+    worker->wake.notify_one();
+    current_deferred = true;
+    return true;
+  }
+
+  void state_changed()
+  {
+    tree::invalidate();
+  }
+
+  void begin_transaction()
+  {
+    if (current_conn == no_connection) {
+      throw std::runtime_error("Transactions are only supported on the socket");
+    }
+    // The requests that follow are held back as they are read, until
+    // `commit`. Only a `begin` held back in a transaction runs while one is
+    // open.
+    if (current_transaction != nullptr) {
+      throw std::runtime_error("A transaction is already open");
+    }
+    if (!current_boundary) {
+      throw std::runtime_error("begin must be a request of its own");
+    }
+  }
+
+  void commit_transaction()
+  {
+    if (!current_boundary) {
+      throw std::runtime_error("commit must be a request of its own");
+    }
+    if (current_transaction == nullptr) {
+      throw std::runtime_error("No transaction is open");
+    }
+    // Stays open while the requests run, so a queued `begin` fails
+    auto conn        = current_conn;
+    auto* commit     = current_request;
+    current_boundary = false;
+    xcb::ConfigureBatch batch;
+    for (auto& queued : *current_transaction) {
+      if (queued.error) {
+        post(queued.conn, queued.req, std::move(*queued.error),
+             binary::Status::Error);
+      } else {
+        run_queued(&queued, 1);
+      }
+    }
+    current_conn        = conn;
+    current_request     = commit;
+    current_transaction = nullptr;
+  }
+
+  /// Whether a request opens a transaction on the socket
+  static bool is_begin(Request const& req)
+  {
+    if (req.selector || !req.arena->args.empty()) return false;
+    return req.command_id ? *req.command_id == Command::Begin
+                          : req.command == "begin";
+  }
+
+  /// Whether a request ends a transaction, instead of being queued in it
+  static bool is_commit(Request const& req)
+  {
+    if (req.selector || !req.arena->args.empty()) return false;
+    return req.command_id ? *req.command_id == Command::Commit
+                          : req.command == "commit";
+  }
+
+  /// The number in a delta argument, if it is one
+  static std::optional<long> delta_arg(Arg const& arg)
+  {
+    if (auto* num = std::get_if<long>(&arg)) return *num;
+    return to_integer<long>(std::get<std::string_view>(arg));
+  }
+
+  /// Add the delta of `next` to `req`, if both are a `window_move` or both
+  /// are a `window_resize` of the focused window.
+  ///
+  /// \returns false, leaving `req` alone, if they can't be merged.
+  static bool merge_delta(Request& req, Request const& next)
+  {
+    auto delta_command = [](Request const& req) -> std::optional<Command> {
+      if (req.selector || req.arena->args.size() != 2) return std::nullopt;
+      if (req.command_id) {
+        if (*req.command_id == Command::WindowMove ||
+            *req.command_id == Command::WindowResize) {
+          return req.command_id;
+        }
+      } else if (req.command == "window_move") {
+        return Command::WindowMove;
+      } else if (req.command == "window_resize") {
+        return Command::WindowResize;
+      }
+      return std::nullopt;
+    };
+
+    auto cmd = delta_command(req);
+    if (!cmd || cmd != delta_command(next)) return false;
+    auto& args = req.arena->args;
+    std::optional<long> deltas[] = {delta_arg(args[0]),
+                                    delta_arg(args[1]),
+                                    delta_arg(next.arena->args[0]),
+                                    delta_arg(next.arena->args[1])};
+    for (auto& delta : deltas) {
+      if (!delta) return false;
+    }
+    args[0] = *deltas[0] + *deltas[2];
+    args[1] = *deltas[1] + *deltas[3];
+    return true;
+  }
+
+  static void run_job(Job& job)
+  {
+    switch (job.kind) {
+    case Job::Run:
+      current_boundary =
+        is_begin(job.requests[0].req) || is_commit(job.requests[0].req);
+      run_queued(job.requests.data(), job.requests.size());
+      current_boundary = false;
+      break;
+    case Job::Commit: {
+      auto commit = std::move(job.requests.back());
+      job.requests.pop_back();
+      current_transaction = &job.requests;
+      current_boundary    = true;
+      run_queued(&commit, 1);
+      current_boundary    = false;
+      current_transaction = nullptr;
+    } break;
+    case Job::Fail:
+      post(job.requests[0].conn, job.requests[0].req, std::move(job.error),
+           binary::Status::Error);
+      break;
+    case Job::Close: unsubscribe(job.closed); break;
+    }
+    check_waiters();
+  }
+
+  void run_requests()
+  {
+    if (pending.empty()) return;
+    // Flushed once for all the requests
+    xcb::FlushBatch batch;
+    for (std::size_t i = 0; i < pending.size(); i++) {
+      auto& job = pending[i];
+      if (job.kind == Job::Run) {
+        auto count = job.requests.size();
+        while (i + 1 < pending.size() && pending[i + 1].kind == Job::Run) {
+          auto& next = pending[i + 1].requests;
+          if (!merge_delta(job.requests[0].req, next[0].req)) break;
+          std::move(next.begin(), next.end(), std::back_inserter(job.requests));
+          i++;
+        }
+        if (job.requests.size() > count) {
+          LOG(Debug) << "Merged " << job.requests.size() << " requests";
+        }
+      }
+      run_job(job);
+    }
+    pending.clear();
+  }
+
+  static void remove_endpoint()
+  {
+    if (active == Transport::Fifo) {
+      remove(name.c_str());
+    } else if (auto sock = socket_name(); sock[0] != '\0') {
+      remove(sock.c_str());
+    }
+  }
+
+  static void drop_response(FifoResponse& res, const char* reason)
+  {
+    dropped_responses++;
+    LOG(Error) << "Dropped response to " << res.name << ": " << reason << " ("
+               << dropped_responses << " dropped)";
+  }
+
+  static void close_response(FifoResponse& res)
+  {
+    if (res.fd < 0) return;
+    if (res.watched) loop::remove(res.fd);
+    close(res.fd);
+    res.fd = -1;
+  }
+
+  /// Write as much of the response as possible, without blocking.
+  ///
+  /// \returns false if it has to be tried again later
+  static bool deliver(FifoResponse& res)
+  {
+    if (res.fd < 0) {
+      res.fd = open(res.name.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+      // No reader yet
+      if (res.fd < 0 && errno == ENXIO) return false;
+      if (res.fd < 0) {
+        drop_response(res, strerror(errno));
+        return true;
+      }
+    }
+    while (res.written < res.data.size()) {
+      auto len = write(res.fd, res.data.data() + res.written,
+                       res.data.size() - res.written);
+      if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+      if (len < 0 && errno == EINTR) continue;
+      if (len < 0) {
+        drop_response(res, strerror(errno));
+        break;
+      }
+      res.written += len;
+    }
+    close_response(res);
+    return true;
+  }
+
+  /// Deliver what can be delivered of the fifo responses, dropping the ones
+  /// that timed out.
+  ///
+  /// \returns the time until they have to be retried, in the format of `poll`
+  static int send_fifo_responses()
+  {
+    int timeout = -1;
+    auto now    = std::chrono::steady_clock::now();
+    fifo_responses.erase(
+      std::remove_if(fifo_responses.begin(), fifo_responses.end(),
+                     [&](auto& res) {
+                       if (deliver(res)) return true;
+                       if (now >= res.deadline) {
+                         drop_response(res, "timed out");
+                         close_response(res);
+                         return true;
+                       }
+                       // Opened, but the fifo is full
+                       if (res.fd >= 0 && !res.watched) {
+                         res.watched = true;
+                         loop::add(res.fd, EPOLLOUT, [](std::uint32_t) {});
+                       }
+                       if (res.fd < 0) timeout = response_retry_ms;
+                       return false;
+                     }),
+      fifo_responses.end());
+    return timeout;
+  }
+
+  static void push_job(Job job)
+  {
+    pending.push_back(std::move(job));
+  }
+
+  /// Queue the complete lines in `buffer`, and erase them
+  static void queue_fifo_requests(std::string& buffer)
+  {
+    std::size_t start = 0, end;
+    while ((end = buffer.find('\n', start)) != std::string::npos) {
+      auto line = std::string_view(buffer).substr(start, end - start);
+      start     = end + 1;
+      Job job{Job::Run};
+      job.requests.push_back({no_connection, Request()});
+      if (auto error = parse_message(line, job.requests[0].req)) {
+        LOG(Error) << "Error: " << error->message;
+        job.kind  = Job::Fail;
+        job.error = std::move(error->message);
+      }
+      push_job(std::move(job));
+    }
+    buffer.erase(0, start);
+  }
+
+  static void start_fifo()
   {
     // Multiple writers to one fifo is guarantied to not be interleaved if the
     // messages are < PIPE_BUF, which is at least 512. On OSX and some BSD
     // systems it's 512, on linux it's 4096. Either way, it shouldn't be an
     // issue, as practically all messages are shorter.
-    std::cout << "Request pipe: " << name << '\n';
+    LOG(Info) << "Request pipe: " << name;
 
     // The response pipe must be created before sending the request
     if (mkfifo(name.c_str(), 0666) != 0) {
       errx(EXIT_FAILURE, "Error creating response pipe: %s", strerror(errno));
     }
+    // Opened for writing too, so it doesn't hit EOF between clients
+    fifo_fd = open(name.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fifo_fd < 0) {
+      errx(EXIT_FAILURE, "Error opening request pipe: %s", strerror(errno));
+    }
+    loop::add(fifo_fd, EPOLLIN, [](std::uint32_t) {
+      // Reused, so reading doesn't allocate once it is big enough
+      static std::string buffer;
+      char buf[4096];
+      ssize_t len;
+      while ((len = read(fifo_fd, buf, sizeof(buf))) > 0) {
+        buffer.append(buf, len);
+      }
+      queue_fifo_requests(buffer);
+    });
+  }
 
-    std::atexit([]() { remove(name.c_str()); });
+  /// Stop watching and close a connection. It is erased from `connections`
+  /// by `send_responses`.
+  static void close_connection(Connection& conn)
+  {
+    Job job{Job::Close};
+    job.closed = conn.id;
+    push_job(std::move(job));
+    loop::remove(conn.fd);
+    close(conn.fd);
+    conn.fd = -1;
+  }
 
-    std::signal(SIGINT, [](int sig) {
-      remove(name.c_str());
-      std::exit(sig);
-    });
+  /// Read all requests waiting on a connection, and queue them. Requests
+  /// between `begin` and `commit` are held back, and queued at once with
+  /// the `commit`.
+  ///
+  /// Empty packets are skipped. Once the client shut down its end, as told
+  /// by `hung_up`, they can't be told apart from the end of the stream,
+  /// which reads as empty too.
+  ///
+  /// \returns false if the client hung up.
+  static bool read_requests(Connection& conn, bool hung_up)
+  {
+    while (true) {
+      // Peek first, to find out how big the packet is
+      auto len = recv(conn.fd, nullptr, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+      if (len < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+      if (len == 0) {
+        if (hung_up) return false;
+        // Requests after it are read on the next wakeup. Reading on could
+        // spin, if the client shut down since the loop checked.
+        recv(conn.fd, nullptr, 0, MSG_DONTWAIT);
+        return true;
+      }
 
-    std::signal(SIGABRT, [](int sig) {
-      remove(name.c_str());
-      std::exit(sig);
-    });
+      // Read straight into the arena, where it is parsed in place
+      Queued queued{conn.id, Request()};
+      auto& req   = queued.req;
+      auto& bytes = req.arena->bytes;
+      bytes.resize(len);
+      if (recv(conn.fd, bytes.data(), bytes.size(), MSG_DONTWAIT) != len) {
+        return false;
+      }
+      Job job{Job::Run};
+      if (auto error = parse_message(req)) {
+        LOG(Error) << "Error: " << error->message;
+        job.kind  = Job::Fail;
+        job.error = std::move(error->message);
+      }
 
-    std::signal(SIGTERM, [](int sig) {
-      remove(name.c_str());
-      std::exit(sig);
-    });
+      // Failures in a transaction are answered in order, at the commit
+      if (job.kind == Job::Fail && conn.transaction) {
+        queued.error = std::move(job.error);
+        conn.transaction->push_back(std::move(queued));
+        continue;
+      }
+      if (job.kind == Job::Run && conn.transaction) {
+        if (!is_commit(req)) {
+          conn.transaction->push_back(std::move(queued));
+          continue;
+        }
+        job.kind     = Job::Commit;
+        job.requests = std::move(*conn.transaction);
+        conn.transaction.reset();
+      } else if (job.kind == Job::Run && is_begin(req)) {
+        conn.transaction.emplace();
+      }
+      job.requests.push_back(std::move(queued));
+      push_job(std::move(job));
+    }
+  }
 
-    while (!halt) {
-      errno       = 0;
-      auto stream = std::ifstream(name);
-      if (!stream.is_open()) {
-        errx(EXIT_FAILURE, "Error opening request pipe: %s", strerror(errno));
-      }
-
-      while (stream.good() && !halt) {
-        Request req;
-        try {
-          req = get_request(stream);
-          if (halt) break;
-          std::ostringstream response_buf;
-          std::cout << "Recieved command from " << req.client << ": "
-                    << req.command << " [ ";
-          for (auto& arg : req.args) {
-            std::cout << arg << " ";
-          }
-          std::cout << "]" << '\n';
+  /// Send as many queued responses as the socket takes without blocking.
+  ///
+  /// \returns false if the client hung up.
+  static bool write_responses(Connection& conn)
+  {
+    while (!conn.outbox.empty()) {
+      auto& msg = conn.outbox.front();
+      if (send(conn.fd, msg.data(), msg.size(), MSG_NOSIGNAL | MSG_DONTWAIT) <
+          0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+      conn.outbox.pop_front();
+    }
+    return true;
+  }
 
-          std::unique_lock lock(wm::global_lock);
+  static void handle_connection(ConnId id, std::uint32_t events)
+  {
+    auto* conn = find_connection(id);
+    if (conn == nullptr) return;
+    bool alive = true;
+    bool hung_up = events & (EPOLLHUP | EPOLLRDHUP);
+    if (events & EPOLLIN) alive = read_requests(*conn, hung_up);
+    if (alive && (events & EPOLLOUT)) alive = write_responses(*conn);
+    if (!alive || (events & EPOLLERR) || (hung_up && !(events & EPOLLIN))) {
+      close_connection(*conn);
+    }
+  }
 
-          auto response = call_handler(parse<Command>(req.command),
-                                       Args{std::move(req.args)});
+  static void start_socket()
+  {
+    sockaddr_un addr;
+    auto addr_len = socket_address(addr);
 
-          lock.unlock();
+    listen_fd =
+      socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0) {
+      errx(EXIT_FAILURE, "Error creating socket: %s", strerror(errno));
+    }
+    // A socket file left over from a crash would make bind fail.
+    remove_endpoint();
+    if (bind(listen_fd, (sockaddr*) &addr, addr_len) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+      errx(EXIT_FAILURE, "Error binding socket: %s", strerror(errno));
+    }
+    LOG(Info) << "Request socket: " << (addr.sun_path[0] == '\0' ? "@" : "")
+              << (addr.sun_path[0] == '\0' ? addr.sun_path + 1 : addr.sun_path);
 
-          send_response(req.client, std::move(response));
-        } catch (std::exception& e) {
-          std::cout << "Error: " << e.what() << std::endl;
-          try {
-            send_response(req.client, str_join("Error: ", e.what()));
-          } catch (...) {}
-        }
-        std::flush(std::cout);
+    loop::add(listen_fd, EPOLLIN, [](std::uint32_t) {
+      // Clients bound to keys connect in bursts, take them all at once
+      int fd;
+      while ((fd = accept4(listen_fd, nullptr, nullptr,
+                           SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+        auto id = ++last_conn_id;
+        connections.push_back({fd, id, {}, {}});
+        loop::add(fd, EPOLLIN | EPOLLRDHUP, [id](std::uint32_t events) {
+          handle_connection(id, events);
+        });
+      }
+    });
+  }
+
+  int send_responses()
+  {
+    auto timeout = expire_waiters();
+    for (auto& conn : connections) {
+      if (conn.fd < 0) continue;
+      if (conn.dropped > 0) {
+        LOG(Error) << "Closing connection " << conn.id
+                   << ", it doesn't read its responses (" << conn.dropped
+                   << " dropped, " << dropped_responses << " in total)";
+        close_connection(conn);
+        continue;
+      }
+      take_events(conn.outbox, conn.id);
+      // Most responses fit in the socket buffer, the rest waits for room
+      if (!write_responses(conn)) {
+        close_connection(conn);
+        continue;
+      }
+      bool waiting = !conn.outbox.empty();
+      if (waiting != conn.waiting_to_write) {
+        conn.waiting_to_write = waiting;
+        std::uint32_t events = EPOLLIN | EPOLLRDHUP;
+        if (waiting) events |= EPOLLOUT;
+        loop::modify(conn.fd, events);
       }
     }
-    remove(name.c_str());
+    connections.erase(
+      std::remove_if(connections.begin(), connections.end(),
+                     [](auto& conn) { return conn.fd < 0; }),
+      connections.end());
+
+    auto retry = send_fifo_responses();
+    if (retry >= 0 && (timeout < 0 || retry < timeout)) timeout = retry;
+    return timeout;
   }
 
-  void exit() 
+  void start(Transport transport)
   {
-    halt = true;
-    std::ofstream stream(name);
-    stream << "QUIT";
-    stream.close();
+    active = transport;
+
+    std::atexit(remove_endpoint);
+
+    std::signal(SIGABRT, [](int sig) {
+      remove_endpoint();
+      std::exit(sig);
+    });
 
-    remove(name.c_str());
+    // A client that closes its socket or response fifo early makes the
+    // write fail, instead of killing us
+    std::signal(SIGPIPE, SIG_IGN);
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer_fd < 0) {
+      errx(EXIT_FAILURE, "Error creating timer: %s", strerror(errno));
+    }
+    loop::add(timer_fd, EPOLLIN, [](std::uint32_t) { run_timers(); });
+
+    if (transport == Transport::Fifo) {
+      start_fifo();
+    } else {
+      start_socket();
+    }
+  }
+
+  void stop()
+  {
+    for (auto& conn : connections) {
+      if (conn.fd < 0) continue;
+      loop::remove(conn.fd);
+      close(conn.fd);
+    }
+    connections.clear();
+    for (auto& res : fifo_responses) close_response(res);
+    fifo_responses.clear();
+    for (int* fd : {&listen_fd, &fifo_fd, &timer_fd}) {
+      if (*fd < 0) continue;
+      loop::remove(*fd);
+      close(*fd);
+      *fd = -1;
+    }
+    timers.clear();
+    remove_endpoint();
   }
 } // namespace ipc
@@ -1,6 +1,15 @@
 #pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <type_traits>
+#include <variant>
 #include <vector>
 
 #include "commands.hpp"
@@ -9,45 +18,176 @@
 
 namespace ipc {
 
+  /// Why a request could not be run.
+  ///
+  /// Mistakes in requests, like a typo in a number or a missing argument,
+  /// are returned as an `Error` instead of thrown, so they don't unwind.
+  struct Error {
+    std::string message;
+  };
+
+  /// A value, or the error that kept it from being made. A stand-in for
+  /// `std::expected`.
+  template<typename T>
+  class Expected {
+  public:
+    Expected(T value) : state(std::in_place_index<0>, std::move(value)) {}
+    Expected(Error error) : state(std::in_place_index<1>, std::move(error)) {}
+
+    explicit operator bool() const noexcept
+    {
+      return state.index() == 0;
+    }
+
+    T& operator*()
+    {
+      return std::get<0>(state);
+    }
+
+    T* operator->()
+    {
+      return &std::get<0>(state);
+    }
+
+    Error& error()
+    {
+      return std::get<1>(state);
+    }
+
+    /// The value, or the error thrown as `std::runtime_error`
+    T value() &&
+    {
+      if (!*this) throw std::runtime_error(error().message);
+      return std::move(**this);
+    }
+
+  private:
+    std::variant<T, Error> state;
+  };
+
   /// Parse a type from string
   template<typename T>
-  T parse(std::string const&);
+  Expected<T> try_parse(std::string_view);
+
+  /// Parse a type from string, throwing if it fails
+  template<typename T>
+  T parse(std::string_view str)
+  {
+    return try_parse<T>(str).value();
+  }
 
   /// Convert to string. Used for returning data.
   template<typename T>
   std::string to_string(T&& t);
 
+  /// An argument recieved from the client.
+  ///
+  /// Text requests only carry strings. Binary requests can also carry
+  /// integers, which are used as is for integer and enum parameters.
+  ///
+  /// Strings are views into the buffer the request was read into, and are
+  /// only valid while the request is handled.
+  using Arg = std::variant<std::string_view, long>;
+
+  /// Convert an integer from a binary request to enum `E`.
+  ///
+  /// \returns an error if no value of `E` has that number
+  template<typename E>
+  Expected<E> enum_from_integer(long value);
+
+  /// Parse an argument as `T`. Integers must be in the range of `T`.
+  template<typename T>
+  Expected<T> try_parse(Arg const& arg)
+  {
+    if (auto* str = std::get_if<std::string_view>(&arg)) {
+      return try_parse<T>(*str);
+    }
+    auto value = std::get<long>(arg);
+    if constexpr (std::is_enum_v<T>) {
+      return enum_from_integer<T>(value);
+    } else if constexpr (std::is_integral_v<T>) {
+      using Limits = std::numeric_limits<T>;
+      bool fits    = std::is_unsigned_v<T>
+                    ? value >= 0 &&
+                        static_cast<unsigned long>(value) <= Limits::max()
+                    : value >= static_cast<long>(Limits::min()) &&
+                        value <= static_cast<long>(Limits::max());
+      if (!fits) {
+        return Error{std::to_string(value) + " is out of range"};
+      }
+      return static_cast<T>(value);
+    } else {
+      return Error{"Expected a string argument"};
+    }
+  }
+
+  /// Parse an argument as `T`, throwing if it fails
+  template<typename T>
+  T parse(Arg const& arg)
+  {
+    return try_parse<T>(arg).value();
+  }
+
   /// Arguments recieved from the client.
   ///
-  /// These are passed to the handlers, which then extract their values using
+  /// Most handlers declare the types of their args as parameters, and get
+  /// them parsed and counted before they run. Handlers taking a variable
+  /// number of args get these instead, and extract their values using
   /// `auto [window, direction] = args.parse<Window, Direction>()`
+  ///
+  /// Args don't own the values, so they are cheap to pass around. Handlers
+  /// that keep them past the request must copy them.
   struct Args {
 
     /// Get a tuple of args parsed as `Types...`
     template<typename... Types>
     std::tuple<Types...> parse() const
     {
-      return arg_parser_impl<Types...>(strings.cbegin() + shifted, std::index_sequence_for<Types...>());
+      return arg_parser_impl<Types...>(std::index_sequence_for<Types...>());
     }
 
     /// Get arg at `I` parsed as `T`
     template<std::size_t I, typename T>
     T parse() const
     {
-      return ipc::parse<T>(strings.at(shifted + I));
+      return ipc::parse<T>(at(I));
     }
 
     /// Get arg at `i` parsed as `T`
     template<typename T>
     T parse(std::size_t i) const
     {
-      return ipc::parse<T>(strings.at(shifted + i));
+      return ipc::parse<T>(at(i));
+    }
+
+    /// Get arg at `I` parsed as `T`, or the error
+    template<std::size_t I, typename T>
+    Expected<T> try_parse() const
+    {
+      return ipc::try_parse<T>(at(I));
+    }
+
+    /// Get arg number `n` as a string
+    std::string operator[](std::size_t n) const
+    {
+      auto& arg = at(n);
+      if (auto* str = std::get_if<std::string_view>(&arg)) {
+        return std::string(*str);
+      }
+      return std::to_string(std::get<long>(arg));
+    }
+
+    /// Get arg `n`, counting from the first one not shifted
+    Arg const& at(std::size_t n) const
+    {
+      if (n >= size()) throw std::out_of_range("Missing argument");
+      return values[shifted + n];
     }
 
-    /// Get arg number `n`
-    std::string const& operator[](std::size_t n) const
+    /// Number of args left
+    std::size_t size() const noexcept
     {
-      return strings.at(shifted + n);
+      return count - shifted;
     }
 
     void shift(std::size_t n)
@@ -55,32 +195,222 @@ namespace ipc {
       shifted += n;
     }
 
-    std::vector<std::string> strings;
+    Arg const* values  = nullptr;
+    std::size_t count   = 0;
     std::size_t shifted = 0;
 
   private:
 
     // util
     template<typename... Types, std::size_t... Idxs>
-    static auto arg_parser_impl(
-      std::vector<std::string>::const_iterator iter,
-      std::index_sequence<Idxs...> seq)
+    auto arg_parser_impl(std::index_sequence<Idxs...> seq) const
     {
-      return std::make_tuple(ipc::parse<Types>(*(iter + Idxs))...);
+      return std::make_tuple(ipc::parse<Types>(at(Idxs))...);
     }
   };
 
   /// A simple tag type for enums
   /// 
   /// Used for the command handlers. They should be functions of the form
-  /// `R handler(Tag<Commands::Cmd>, Args);`, where `R` is any type that can
-  /// be converted to string using `ipc::to_string`
+  /// `R handler(For<Command::Cmd>, Params...);`, where `R` is void, an
+  /// `Expected<std::string>` or any type that can be converted to string
+  /// using `ipc::to_string`.
+  ///
+  /// `Params` are the types the args are parsed as. Trailing ones can be
+  /// `std::optional`, for optional args. A handler taking `Args` instead gets
+  /// them as they are, however many there are.
   template<auto V>
   struct For {};
 
-  /// Run the loop
-  void run();
+  /// The transport used to recieve requests from clients
+  enum struct Transport {
+    /// A `SOCK_SEQPACKET` unix socket. One connection carries both the
+    /// request and the response.
+    Socket,
+    /// The legacy request fifo, with one response fifo per client.
+    Fifo,
+  };
+
+  /// Events streamed to subscribed clients
+  enum struct Event : unsigned {
+    Focus     = 1 << 0,
+    Map       = 1 << 1,
+    Unmap     = 1 << 2,
+    Destroy   = 1 << 3,
+    Workspace = 1 << 4,
+  };
+
+  /// A set of events, parsed from `focus,map,...` or `all`
+  struct EventMask {
+    unsigned bits = 0;
+
+    bool has(Event event) const noexcept
+    {
+      return (bits & static_cast<unsigned>(event)) != 0;
+    }
+  };
+
+  /// Subscribe the client of the current request to `mask`.
+  ///
+  /// From then on, the connection recieves one response per event, framed
+  /// like the response to the subscribe request.
+  ///
+  /// \throws if the request did not come in on the socket
+  void subscribe(EventMask mask);
+
+  /// A condition to wait for, parsed from `map:<class>`, `focus` or
+  /// `empty:<workspace>`
+  struct Predicate {
+    enum Kind {
+      /// A window with this instance or class name is mapped
+      Mapped,
+      /// The focused window is not `focused` anymore
+      Focus,
+      /// Workspace `workspace` has no windows
+      Empty,
+    } kind;
+    std::string window_class = {};
+    std::uint32_t workspace = 0;
+    std::uint32_t focused   = 0;
+  };
+
+  /// The windows a window command is applied to, instead of the focused one.
+  ///
+  /// Parsed from `id:<window>`, `class:<class>`, `ws:<workspace>`, `all`,
+  /// `mapped` or `under_pointer`.
+  struct Selector {
+    enum Kind {
+      Id,
+      /// Windows with this instance or class name
+      Class,
+      /// All windows of a workspace
+      Workspace,
+      All,
+      Mapped,
+      UnderPointer,
+    } kind;
+    std::uint32_t window = 0;
+    std::string window_class = {};
+    std::uint32_t workspace = 0;
+  };
+
+  /// Parse a selector.
+  ///
+  /// \returns `std::nullopt` if `str` isn't shaped like one, or an error if
+  /// it is, but its value is invalid
+  Expected<std::optional<Selector>> parse_selector(std::string_view str);
+
+  /// Check a predicate against the current state.
+  ///
+  /// \returns the response to the waiting client if `pred` holds, that is the
+  /// window for `Mapped` and `Focus`.
+  std::optional<std::string> check(Predicate const& pred);
+
+  /// Respond to the current request once `pred` holds, or with an error once
+  /// `timeout` expires. `pred` is checked after each event and command.
+  ///
+  /// \throws if the request did not come in on the socket
+  void wait_for(Predicate pred,
+                std::optional<std::chrono::milliseconds> timeout);
+
+  /// Run `cmd` with `args` after `delay`, and every `delay` after that if
+  /// `repeat` is set. The timers are run by the event loop.
+  ///
+  /// \returns an id for `cancel`, or an error if the args don't fit `cmd`,
+  /// or too many commands are scheduled already
+  /// \throws if the event loop isn't running
+  Expected<unsigned> schedule(std::chrono::milliseconds delay,
+                              bool repeat,
+                              Command cmd,
+                              Args args);
+
+  /// Cancel a scheduled command.
+  ///
+  /// \returns false if no command has that id
+  bool cancel(unsigned id);
+
+  /// Define `name` as the commands in `args`, separated by `;`. The commands
+  /// and their args are parsed right away.
+  ///
+  /// \throws if a command doesn't exist or its args don't fit, or `name` is
+  /// a command
+  void define_macro(std::string_view name, Args const& args);
+
+  /// Run the commands of a macro, flushing the X connection once at the end.
+  ///
+  /// \returns the non empty responses of the commands, one per line, or the
+  /// error of the first one that failed
+  Expected<std::string> run_macro(std::string_view name);
+
+  /// Start queueing the requests of the current connection, until `commit`.
+  ///
+  /// \throws if the request did not come in on the socket, or a transaction
+  /// is already open
+  void begin_transaction();
+
+  /// Run the requests queued since `begin`, back to back, sending the
+  /// resulting window changes to the X server at once. Each request gets
+  /// its response as usual.
+  ///
+  /// \throws if no transaction is open
+  void commit_transaction();
+
+  /// Respond to the current request with the result of `work`, run on the
+  /// worker thread. For responses that take long to serialize, so they don't
+  /// hold up the loop. `work` must not touch the state of the window
+  /// manager, only what it captured.
+  ///
+  /// \returns false if the response can't be deferred, because the request
+  /// has no sequence id to match it by, is part of a macro or a transaction,
+  /// or came in on the X connection. The caller should then run `work`
+  /// itself.
+  bool respond_later(std::function<std::string()> work);
+
+  /// Queue an event for the subscribed clients, sent by `send_responses`.
+  /// Never blocks on a client: if a subscriber falls behind, the event is
+  /// dropped for it and counted instead.
+  void notify(Event event, std::string const& data);
+
+  /// Run a request in the wire format, and return the response, if the
+  /// client wants one.
+  ///
+  /// For requests that arrive on the X connection. They run right away,
+  /// while requests from clients of the socket or fifo wait for
+  /// `run_requests`.
+  std::optional<std::string> handle_message(std::string_view message);
+
+  /// Apply the settings in a config file, one `wm_config` key and its
+  /// values per line, like `border_width 5`. Everything after a `#` is a
+  /// comment. Borders and button grabs are updated once, after the whole
+  /// file is read. Lines that can't be applied are logged and skipped.
+  ///
+  /// \returns false if the file can't be read
+  bool load_config(const char* path);
+
+  /// Open the endpoint for `transport`, and add it to the event loop,
+  /// along with the timer of scheduled commands. Requests are read as the
+  /// loop sees them, and queued for `run_requests`.
+  void start(Transport transport = Transport::Socket);
+
+  /// Run the requests read since the last call, in order. Called by the loop
+  /// once per wakeup, after all ready descriptors were read, so requests
+  /// sent at once by different clients can be merged.
+  void run_requests();
+
+  /// Send the queued responses and events, as far as possible without
+  /// blocking. Called by the loop once per wakeup, after the X connection
+  /// was flushed, so a client sees the changes once it has the response.
+  ///
+  /// \returns how long the loop may wait before calling this again, in the
+  /// format of `poll`, for `wait_for` timeouts and fifo clients that didn't
+  /// open their response fifo yet
+  int send_responses();
+
+  /// Note that the state may have changed, so the next query takes a new
+  /// snapshot of it. Called by the loop after handling X events. Requests
+  /// and scheduled commands note it themselves, unless they only read.
+  void state_changed();
 
-  /// Kill the loop;
-  void exit();
-}
+  /// Close the endpoint and the connections
+  void stop();
+}
\ No newline at end of file
@@ -0,0 +1,377 @@
+#pragma once
+
+#include <charconv>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../types.hpp"
+#include "../wm.hpp"
+#include "../xcb.hpp"
+
+/// Serialization of the whole window tree, for `get_tree`.
+///
+/// The tree is serialized from a `Snapshot` of the state, so that big trees
+/// can be written on the worker thread. Everything is appended to the
+/// response as it is visited, without building intermediate strings.
+namespace ipc::tree {
+
+  enum struct Format {
+    /// One object, with `monitors`, `workspaces` and `bars` arrays
+    Json,
+    /// One record per line, with the record type in the first column
+    Tsv,
+  };
+
+  /// Indexed by `WindowType`
+  static const char* const window_type_names[] = {
+    "desktop", "dock",         "toolbar", "menu", "utility",
+    "splash",  "dialog",       "dropdown_menu",   "popup_menu",
+    "tooltip", "notification", "combo",   "dnd",  "normal",
+  };
+
+  /// Append an integer
+  template<typename T>
+  void put(std::string& out, T value)
+  {
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, res.ptr);
+  }
+
+  /// Append a string as a JSON string literal
+  void put_json(std::string& out, std::string_view str)
+  {
+    out += '"';
+    for (char c : str) {
+      switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          out += "\\u00";
+          out += "0123456789abcdef"[(c >> 4) & 0xf];
+          out += "0123456789abcdef"[c & 0xf];
+        } else {
+          out += c;
+        }
+      }
+    }
+    out += '"';
+  }
+
+  /// Append a string as a TSV field. Tabs and newlines would break the
+  /// record, so they become spaces.
+  void put_tsv(std::string& out, std::string_view str)
+  {
+    for (char c : str) out += (c == '\t' || c == '\n') ? ' ' : c;
+  }
+
+  /// Writes JSON objects and arrays, keeping track of the commas
+  struct JsonWriter {
+    std::string& out;
+    bool first = true;
+
+    void open(char c)
+    {
+      out += c;
+      first = true;
+    }
+
+    void close(char c)
+    {
+      out += c;
+      first = false;
+    }
+
+    /// Start a value in an array
+    void item()
+    {
+      if (!first) out += ',';
+      first = false;
+    }
+
+    /// Start a value in an object
+    void key(const char* name)
+    {
+      item();
+      out += '"';
+      out += name;
+      out += "\":";
+    }
+
+    template<typename T>
+    void field(const char* name, T value)
+    {
+      key(name);
+      put(out, value);
+    }
+
+    void field(const char* name, bool value)
+    {
+      key(name);
+      out += value ? "true" : "false";
+    }
+
+    void field(const char* name, std::string_view value)
+    {
+      key(name);
+      put_json(out, value);
+    }
+  };
+
+  /// A copy of everything `get_tree` shows. It is immutable once built, and
+  /// holds no pointers into the live state, so it can be serialized off the
+  /// loop while windows keep moving.
+  struct Snapshot {
+    struct Window {
+      xcb_window_t window;
+      WindowType window_type;
+      std::string instance_name, class_name;
+      Geometry geom;
+      int border_width;
+      uint32_t border_color;
+      uint16_t min_width, min_height, max_width, max_height;
+      uint16_t width_inc, height_inc;
+      bool mapped, should_map, fullscreen, hmaxed, vmaxed, allow_offscreen;
+      std::optional<std::string> monitor;
+    };
+
+    struct Monitor {
+      xcb_randr_output_t output;
+      std::string name;
+      Geometry geom;
+    };
+
+    struct Workspace {
+      uint32_t index;
+      bool bar_shown;
+      std::vector<Window> windows;
+    };
+
+    xcb_window_t focused;
+    uint32_t current_workspace;
+    std::vector<Monitor> monitors;
+    std::vector<Workspace> workspaces;
+    std::vector<Window> bars;
+    /// Including bars
+    std::size_t window_count = 0;
+  };
+
+  using SnapshotPtr = std::shared_ptr<const Snapshot>;
+
+  Snapshot::Window capture(Client const& cl)
+  {
+    std::optional<std::string> monitor;
+    if (cl.monitor != nullptr && cl.monitor->name != nullptr) {
+      monitor = cl.monitor->name;
+    }
+    return {cl.window,        cl.window_type,  cl.instance_name,
+            cl.class_name,    cl.geom,         cl.border_width,
+            cl.border_color,  cl.min_width,    cl.min_height,
+            cl.max_width,     cl.max_height,   cl.width_inc,
+            cl.height_inc,    cl.mapped,       cl.should_map,
+            cl.fullscreen,    cl.hmaxed,       cl.vmaxed,
+            cl.allow_offscreen, std::move(monitor)};
+  }
+
+  SnapshotPtr capture()
+  {
+    auto snap     = std::make_shared<Snapshot>();
+    auto* focused = wm::focused_client();
+    snap->focused = focused == nullptr ? 0u : focused->window;
+    snap->current_workspace = wm::current_ws().index;
+    for (auto& mon : xcb::monitors()) {
+      snap->monitors.push_back(
+        {mon.monitor, mon.name == nullptr ? "" : mon.name, mon.geom});
+    }
+    for (auto& ws : wm::workspaces()) {
+      auto& copy = snap->workspaces.emplace_back(
+        Snapshot::Workspace{ws.index, ws.bar_shown, {}});
+      copy.windows.reserve(ws.windows.size());
+      for (auto& cl : ws.windows) copy.windows.push_back(capture(cl));
+      snap->window_count += ws.windows.size();
+    }
+    for (auto& cl : wm::bar_list()) snap->bars.push_back(capture(cl));
+    snap->window_count += snap->bars.size();
+    return snap;
+  }
+
+  /// The last snapshot, or null once the state has changed since
+  static SnapshotPtr current_snapshot;
+
+  /// The state as of now. Queries in a row share one snapshot, it is only
+  /// copied again after events or commands changed something.
+  SnapshotPtr snapshot()
+  {
+    if (current_snapshot == nullptr) current_snapshot = capture();
+    return current_snapshot;
+  }
+
+  /// Drop the current snapshot. Serializations still running keep their
+  /// own reference to it.
+  void invalidate()
+  {
+    current_snapshot = nullptr;
+  }
+
+  void write_json(JsonWriter& json, Snapshot::Window const& cl)
+  {
+    json.item();
+    json.open('{');
+    json.field("window", cl.window);
+    json.field("type", std::string_view(
+                         window_type_names[static_cast<int>(cl.window_type)]));
+    json.field("instance", std::string_view(cl.instance_name));
+    json.field("class", std::string_view(cl.class_name));
+    json.field("x", cl.geom.x);
+    json.field("y", cl.geom.y);
+    json.field("width", cl.geom.width);
+    json.field("height", cl.geom.height);
+    json.field("border_width", cl.border_width);
+    json.field("border_color", cl.border_color);
+    json.field("min_width", cl.min_width);
+    json.field("min_height", cl.min_height);
+    json.field("max_width", cl.max_width);
+    json.field("max_height", cl.max_height);
+    json.field("width_inc", cl.width_inc);
+    json.field("height_inc", cl.height_inc);
+    json.field("mapped", cl.mapped);
+    json.field("should_map", cl.should_map);
+    json.field("fullscreen", cl.fullscreen);
+    json.field("hmaxed", cl.hmaxed);
+    json.field("vmaxed", cl.vmaxed);
+    json.field("allow_offscreen", cl.allow_offscreen);
+    json.key("monitor");
+    if (cl.monitor) {
+      put_json(json.out, *cl.monitor);
+    } else {
+      json.out += "null";
+    }
+    json.close('}');
+  }
+
+  void write_json(std::string& out, Snapshot const& snap)
+  {
+    JsonWriter json{out};
+
+    json.open('{');
+    json.field("focused", snap.focused);
+    json.field("current_workspace", snap.current_workspace + 1);
+
+    json.key("monitors");
+    json.open('[');
+    for (auto& mon : snap.monitors) {
+      json.item();
+      json.open('{');
+      json.field("output", mon.output);
+      json.field("name", std::string_view(mon.name));
+      json.field("x", mon.geom.x);
+      json.field("y", mon.geom.y);
+      json.field("width", mon.geom.width);
+      json.field("height", mon.geom.height);
+      json.close('}');
+    }
+    json.close(']');
+
+    json.key("workspaces");
+    json.open('[');
+    for (auto& ws : snap.workspaces) {
+      json.item();
+      json.open('{');
+      json.field("index", ws.index + 1);
+      json.field("bar_shown", ws.bar_shown);
+      json.key("windows");
+      json.open('[');
+      for (auto& cl : ws.windows) write_json(json, cl);
+      json.close(']');
+      json.close('}');
+    }
+    json.close(']');
+
+    json.key("bars");
+    json.open('[');
+    for (auto& cl : snap.bars) write_json(json, cl);
+    json.close(']');
+    json.close('}');
+  }
+
+  /// `window <workspace> <window> <type> <instance> <class> <x> <y> <width>
+  /// <height> <border_width> <mapped> <fullscreen> <hmaxed> <vmaxed>
+  /// <monitor>`, with workspace 0 for bars
+  void write_tsv(std::string& out,
+                 Snapshot::Window const& cl,
+                 std::uint32_t workspace)
+  {
+    out += "window\t";
+    put(out, workspace);
+    out += '\t';
+    put(out, cl.window);
+    out += '\t';
+    out += window_type_names[static_cast<int>(cl.window_type)];
+    out += '\t';
+    put_tsv(out, cl.instance_name);
+    out += '\t';
+    put_tsv(out, cl.class_name);
+    for (int value : {int(cl.geom.x), int(cl.geom.y), int(cl.geom.width),
+                      int(cl.geom.height), cl.border_width, int(cl.mapped),
+                      int(cl.fullscreen), int(cl.hmaxed), int(cl.vmaxed)}) {
+      out += '\t';
+      put(out, value);
+    }
+    out += '\t';
+    if (cl.monitor) put_tsv(out, *cl.monitor);
+    out += '\n';
+  }
+
+  /// Also writes `monitor <name> <x> <y> <width> <height>` and
+  /// `workspace <index> <bar_shown> <windows> <current>` records
+  void write_tsv(std::string& out, Snapshot const& snap)
+  {
+    for (auto& mon : snap.monitors) {
+      out += "monitor\t";
+      put_tsv(out, mon.name);
+      for (int value : {int(mon.geom.x), int(mon.geom.y),
+                        int(mon.geom.width), int(mon.geom.height)}) {
+        out += '\t';
+        put(out, value);
+      }
+      out += '\n';
+    }
+    for (auto& ws : snap.workspaces) {
+      out += "workspace\t";
+      put(out, ws.index + 1);
+      out += '\t';
+      put(out, int(ws.bar_shown));
+      out += '\t';
+      put(out, ws.windows.size());
+      out += '\t';
+      put(out, int(ws.index == snap.current_workspace));
+      out += '\n';
+    }
+    for (auto& ws : snap.workspaces) {
+      for (auto& cl : ws.windows) write_tsv(out, cl, ws.index + 1);
+    }
+    for (auto& cl : snap.bars) write_tsv(out, cl, 0);
+    // The response gets its own newline
+    if (!out.empty()) out.pop_back();
+  }
+
+  /// Append `snap` to `out`. Only reads the snapshot, so it is safe on any
+  /// thread.
+  void write(std::string& out, Snapshot const& snap, Format format)
+  {
+    // Enough for a few dozen windows without reallocating
+    out.reserve(out.size() + 8192);
+    if (format == Format::Json) {
+      write_json(out, snap);
+    } else {
+      write_tsv(out, snap);
+    }
+  }
+
+} // namespace ipc::tree
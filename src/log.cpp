@@ -0,0 +1,196 @@
+#include "log.hpp"
+
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <unistd.h>
+
+namespace logging {
+
+#ifdef D
+  std::atomic<Level> threshold = Level::Debug;
+#else
+  std::atomic<Level> threshold = Level::Info;
+#endif
+
+  namespace {
+
+    /// Must be a power of two
+    constexpr std::size_t ring_size = 1024;
+    constexpr std::size_t ring_mask = ring_size - 1;
+
+    /// A bounded MPMC queue in the style of Vyukov, with a single consumer.
+    ///
+    /// A slot is free for position `pos` when its sequence is `pos`, and
+    /// holds the message at `pos` when it is `pos + 1`. The sequence is
+    /// stored minus the slot index, so the zero initialized ring is ready
+    /// before any constructor runs.
+    struct Slot {
+      std::atomic<std::size_t> seq;
+      Level level;
+      std::uint16_t size;
+      char text[max_line];
+    };
+
+    Slot _ring[ring_size];
+    /// Next position to write, claimed by producers
+    std::atomic<std::size_t> _head = 0;
+    /// Next position to read. Guarded by `Drain::lock`
+    std::size_t _tail = 0;
+    std::atomic<std::size_t> _dropped = 0;
+    /// Set by the writer thread before it waits, cleared by the first
+    /// producer to queue a message after that
+    std::atomic<bool> _sleeping = false;
+
+    /// Never destroyed, the writer thread may still use it during exit
+    struct Drain {
+      std::mutex lock;
+      std::mutex wake_lock;
+      std::condition_variable wake;
+      char buffer[ring_size / 4 * (max_line + 1)];
+    };
+
+    Drain& drain()
+    {
+      static auto* res = new Drain();
+      return *res;
+    }
+
+    /// Indexed by `Level`
+    constexpr std::string_view prefixes[] = {"error: ", "info: ", "debug: "};
+
+    std::size_t seq_at(std::size_t pos)
+    {
+      return _ring[pos & ring_mask].seq.load() + (pos & ring_mask);
+    }
+
+    bool empty()
+    {
+      return seq_at(_tail) != _tail + 1;
+    }
+
+    /// Write out what is queued. `drain().lock` must be held.
+    void write_queued(Drain& d)
+    {
+      std::size_t size = 0;
+      auto write_out   = [&] {
+        for (std::size_t done = 0; done < size;) {
+          auto res = ::write(STDERR_FILENO, d.buffer + done, size - done);
+          if (res <= 0) break;
+          done += res;
+        }
+        size = 0;
+      };
+
+      if (auto dropped = _dropped.exchange(0); dropped > 0) {
+        size = std::snprintf(d.buffer, sizeof(d.buffer),
+                             "error: %zu log messages dropped\n", dropped);
+      }
+      while (!empty()) {
+        auto& slot  = _ring[_tail & ring_mask];
+        auto prefix = prefixes[static_cast<int>(slot.level)];
+        if (size + prefix.size() + slot.size + 1 > sizeof(d.buffer)) {
+          write_out();
+        }
+        prefix.copy(d.buffer + size, prefix.size());
+        size += prefix.size();
+        std::memcpy(d.buffer + size, slot.text, slot.size);
+        size += slot.size;
+        d.buffer[size++] = '\n';
+        slot.seq.store(_tail + ring_size - (_tail & ring_mask));
+        _tail++;
+      }
+      write_out();
+    }
+
+    void run()
+    {
+      auto& d = drain();
+      for (;;) {
+        {
+          std::lock_guard lock(d.lock);
+          write_queued(d);
+        }
+        std::unique_lock lock(d.wake_lock);
+        _sleeping = true;
+        // A message may have been queued before we were asleep
+        if (!empty()) {
+          _sleeping = false;
+          continue;
+        }
+        d.wake.wait_for(lock, std::chrono::seconds(1),
+                        [] { return !_sleeping.load(); });
+        _sleeping = false;
+      }
+    }
+
+  } // namespace
+
+  void write(Level level, std::string_view message) noexcept
+  {
+    auto pos = _head.load(std::memory_order_relaxed);
+    for (;;) {
+      auto diff = static_cast<std::intptr_t>(seq_at(pos) - pos);
+      if (diff == 0) {
+        if (_head.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      } else {
+        pos = _head.load(std::memory_order_relaxed);
+      }
+    }
+
+    auto& slot = _ring[pos & ring_mask];
+    slot.level = level;
+    slot.size  = static_cast<std::uint16_t>(std::min(message.size(), max_line));
+    message.copy(slot.text, slot.size);
+    slot.seq.store(pos + 1 - (pos & ring_mask));
+
+    // Only the first message after the writer went to sleep wakes it up
+    if (_sleeping.exchange(false)) {
+      auto& d = drain();
+      { std::lock_guard lock(d.wake_lock); }
+      d.wake.notify_one();
+    }
+  }
+
+  void printf(Level level, const char* fmt, ...) noexcept
+  {
+    char text[max_line + 1];
+    va_list args;
+    va_start(args, fmt);
+    int size = std::vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    if (size < 0) return;
+
+    std::string_view message(text, std::min<std::size_t>(size, max_line));
+    // `DMSG` messages carry their own newline
+    if (!message.empty() && message.back() == '\n') message.remove_suffix(1);
+    write(level, message);
+  }
+
+  void start()
+  {
+    drain();
+    std::atexit(flush);
+    std::thread(run).detach();
+  }
+
+  void flush() noexcept
+  {
+    auto& d = drain();
+    std::lock_guard lock(d.lock);
+    write_queued(d);
+  }
+
+} // namespace logging
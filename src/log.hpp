@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/// Asynchronous logging for the event loop.
+///
+/// Messages are formatted into a fixed size line, then copied into a lock
+/// free ring, a bounded MPMC queue, so any thread may log without taking a
+/// lock. A drain thread of its own empties the ring and writes to stderr in
+/// batches, each line prefixed with its level, so a slow reader of stderr
+/// never holds up the window manager.
+/// Messages below the level are skipped before their arguments are even
+/// evaluated, see `LOG`.
+///
+/// When the ring is full, messages are dropped and counted, instead of
+/// waiting for room.
+namespace logging {
+
+  enum struct Level : int {
+    Error,
+    Info,
+    Debug,
+  };
+
+  /// Longest message kept, longer ones are cut
+  constexpr std::size_t max_line = 240;
+
+  extern std::atomic<Level> threshold;
+
+  inline bool enabled(Level level) noexcept
+  {
+    return level <= threshold.load(std::memory_order_relaxed);
+  }
+
+  inline void set_level(Level level) noexcept
+  {
+    threshold.store(level, std::memory_order_relaxed);
+  }
+
+  inline Level level() noexcept
+  {
+    return threshold.load(std::memory_order_relaxed);
+  }
+
+  /// Queue a message, without blocking.
+  void write(Level level, std::string_view message) noexcept;
+
+  /// Queue a printf style message. Used by `DMSG`.
+  void printf(Level level, const char* fmt, ...) noexcept
+    __attribute__((format(printf, 2, 3)));
+
+  /// Start the thread that writes out the messages. Until then, messages
+  /// wait in the ring. Queued messages are also written out at exit.
+  void start();
+
+  /// Write out the queued messages from the calling thread.
+  void flush() noexcept;
+
+  /// A message built with `<<`, queued when it goes out of scope.
+  class Line {
+  public:
+    explicit Line(Level level) noexcept : level(level) {}
+
+    Line(Line const&) = delete;
+    Line& operator=(Line const&) = delete;
+
+    ~Line()
+    {
+      write(level, std::string_view(text, size));
+    }
+
+    Line& operator<<(std::string_view str) noexcept
+    {
+      auto n = std::min(str.size(), max_line - size);
+      str.copy(text + size, n);
+      size += n;
+      return *this;
+    }
+
+    Line& operator<<(const char* str) noexcept
+    {
+      return *this << std::string_view(str);
+    }
+
+    Line& operator<<(std::string const& str) noexcept
+    {
+      return *this << std::string_view(str);
+    }
+
+    Line& operator<<(char c) noexcept
+    {
+      if (size < max_line) text[size++] = c;
+      return *this;
+    }
+
+    template<typename T,
+             typename = std::enable_if_t<std::is_integral_v<T> &&
+                                         !std::is_same_v<T, char> &&
+                                         !std::is_same_v<T, bool>>>
+    Line& operator<<(T value) noexcept
+    {
+      auto res = std::to_chars(text + size, text + max_line, value);
+      if (res.ec == std::errc()) size = res.ptr - text;
+      return *this;
+    }
+
+  private:
+    Level level;
+    std::size_t size = 0;
+    char text[max_line];
+  };
+
+} // namespace logging
+
+/// `LOG(Info) << "Recieved " << n << " requests";` The message is only
+/// built if the level is enabled.
+#define LOG(level)                                             \
+  if (!logging::enabled(logging::Level::level)) {              \
+  } else                                                       \
+    logging::Line(logging::Level::level)
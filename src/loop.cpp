@@ -0,0 +1,91 @@
+#include "loop.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <err.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace loop {
+
+  namespace {
+
+    /// Ready descriptors handled per wakeup. More are left for the next one.
+    constexpr int max_events = 64;
+
+    struct Watch {
+      Handler handler;
+      /// Bumped when the descriptor is removed, so events read for it
+      /// don't reach whatever reuses the number in the same wakeup
+      std::uint32_t generation = 0;
+    };
+
+    int _epoll_fd = -1;
+    /// Indexed by descriptor
+    std::vector<Watch> _watches;
+
+    epoll_event make_event(int fd, std::uint32_t events)
+    {
+      epoll_event ev = {};
+      ev.events      = events;
+      ev.data.u64 =
+        (std::uint64_t(_watches[fd].generation) << 32) | std::uint32_t(fd);
+      return ev;
+    }
+
+  } // namespace
+
+  void init()
+  {
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll_fd < 0) {
+      errx(EXIT_FAILURE, "Error creating epoll: %s", strerror(errno));
+    }
+  }
+
+  void add(int fd, std::uint32_t events, Handler handler)
+  {
+    if (std::size_t(fd) >= _watches.size()) _watches.resize(fd + 1);
+    _watches[fd].handler = std::move(handler);
+    auto ev              = make_event(fd, events);
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      errx(EXIT_FAILURE, "Error watching %d: %s", fd, strerror(errno));
+    }
+  }
+
+  void modify(int fd, std::uint32_t events)
+  {
+    auto ev = make_event(fd, events);
+    epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+  }
+
+  void remove(int fd)
+  {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    auto& watch = _watches[fd];
+    watch.handler = nullptr;
+    watch.generation++;
+  }
+
+  void wait(int timeout)
+  {
+    epoll_event events[max_events];
+    int count = epoll_wait(_epoll_fd, events, max_events, timeout);
+    if (count < 0 && errno != EINTR) {
+      errx(EXIT_FAILURE, "Error waiting for events: %s", strerror(errno));
+    }
+    for (int i = 0; i < count; i++) {
+      auto fd         = int(events[i].data.u64 & 0xffffffff);
+      auto generation = std::uint32_t(events[i].data.u64 >> 32);
+      auto& watch     = _watches[fd];
+      if (watch.generation != generation || !watch.handler) continue;
+      // A copy, as the handler may remove itself
+      auto handler = watch.handler;
+      handler(events[i].events);
+    }
+  }
+
+} // namespace loop
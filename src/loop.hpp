@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+/// The event loop. One thread waits on an epoll instance for the X
+/// connection, the IPC endpoints and connections, timers and signals, and
+/// calls the handler of each descriptor that is ready. Everything runs on
+/// that thread, in the order the loop sees it, so nothing is locked.
+namespace loop {
+
+  /// Called with the ready `EPOLL*` events of a descriptor
+  using Handler = std::function<void(std::uint32_t events)>;
+
+  /// Create the epoll instance. Called before anything is added.
+  void init();
+
+  /// Call `handler` whenever `fd` is ready for `events`
+  void add(int fd, std::uint32_t events, Handler handler);
+
+  /// Change the events `fd` is watched for
+  void modify(int fd, std::uint32_t events);
+
+  /// Stop watching `fd`. Called before it is closed, also from handlers:
+  /// events already read for it are then skipped.
+  void remove(int fd);
+
+  /// Wait until descriptors are ready, or `timeout` passed, and call their
+  /// handlers.
+  ///
+  /// \param timeout in milliseconds, or -1 to wait as long as it takes
+  void wait(int timeout);
+
+} // namespace loop
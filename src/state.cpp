@@ -0,0 +1,76 @@
+#include "state.hpp"
+
+#include <err.h>
+#include <sys/stat.h>
+
+#include "common.hpp"
+#include "wm.hpp"
+
+namespace state {
+
+  namespace {
+    Shared* _shared = nullptr;
+    /// The last published snapshot, to skip publishing when nothing changed
+    Snapshot _last  = {};
+  } // namespace
+
+  void init()
+  {
+    auto name = shm_name();
+    int fd    = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+      warn("couldn't create shared state %s", name.c_str());
+      return;
+    }
+    if (ftruncate(fd, sizeof(Shared)) != 0) {
+      warn("couldn't size shared state");
+      close(fd);
+      return;
+    }
+    void* ptr = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+      warn("couldn't map shared state");
+      return;
+    }
+    _shared = static_cast<Shared*>(ptr);
+    std::memset((void*) _shared, 0, sizeof(Shared));
+    _shared->version = version;
+  }
+
+  void cleanup()
+  {
+    if (_shared == nullptr) return;
+    munmap(_shared, sizeof(Shared));
+    _shared = nullptr;
+    shm_unlink(shm_name().c_str());
+  }
+
+  void publish()
+  {
+    if (_shared == nullptr) return;
+
+    Snapshot snap = {};
+    auto* focused = wm::focused_client();
+    snap.focused_window    = focused != nullptr ? focused->window : 0;
+    snap.current_workspace = wm::current_ws().index;
+    snap.bar_shown         = wm::show_bar();
+    snap.workspace_count   = wm::workspaces().size();
+    for (auto& ws : wm::workspaces()) {
+      if (ws.index >= max_workspaces) break;
+      snap.workspace_bar_shown[ws.index] = ws.bar_shown;
+      snap.window_count[ws.index]        = ws.windows.size();
+    }
+
+    if (std::memcmp(&snap, &_last, sizeof(Snapshot)) == 0) return;
+    _last = snap;
+
+    auto seq = _shared->sequence.load(std::memory_order_relaxed);
+    _shared->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&_shared->data, &snap, sizeof(Snapshot));
+    _shared->sequence.store(seq + 2, std::memory_order_release);
+  }
+
+} // namespace state
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "common.hpp"
+
+/// A read-only snapshot of the WM state in shared memory.
+///
+/// The WM publishes it at the end of every batch of events, and after every
+/// command. Status bars can map it with `state::Reader`, and read it without
+/// talking to the WM at all.
+///
+/// The snapshot is protected by a seqlock: `sequence` is odd while the WM is
+/// writing, and readers retry until they see the same even value before and
+/// after copying the data.
+namespace state {
+
+  constexpr std::uint32_t version        = 1;
+  constexpr std::uint32_t max_workspaces = 64;
+
+  struct Snapshot {
+    /// The focused window, or 0 if no window is focused
+    std::uint32_t focused_window;
+    /// Index of the current workspace, starting from 0
+    std::uint32_t current_workspace;
+    std::uint32_t workspace_count;
+    /// True if the bars are shown on the current workspace
+    std::uint8_t bar_shown;
+    std::uint8_t workspace_bar_shown[max_workspaces];
+    std::uint32_t window_count[max_workspaces];
+  };
+
+  struct Shared {
+    std::uint32_t version;
+    std::atomic<std::uint32_t> sequence;
+    Snapshot data;
+  };
+
+  static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+  /// Maps the snapshot published by the WM.
+  struct Reader {
+    Reader() = default;
+
+    Reader(Reader const&) = delete;
+
+    ~Reader()
+    {
+      if (_shared != nullptr) munmap((void*) _shared, sizeof(Shared));
+    }
+
+    /// Map the shared memory. Returns false if the WM isn't running
+    bool open()
+    {
+      int fd = shm_open(shm_name().c_str(), O_RDONLY, 0);
+      if (fd < 0) return false;
+      void* ptr = mmap(nullptr, sizeof(Shared), PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (ptr == MAP_FAILED) return false;
+      _shared = static_cast<const Shared*>(ptr);
+      return _shared->version == version;
+    }
+
+    /// Get a consistent copy of the snapshot. No syscalls involved.
+    std::optional<Snapshot> read() const noexcept
+    {
+      if (_shared == nullptr) return std::nullopt;
+      Snapshot res;
+      std::uint32_t before, after;
+      do {
+        before = _shared->sequence.load(std::memory_order_acquire);
+        if (before & 1) continue;
+        std::memcpy(&res, (const void*) &_shared->data, sizeof(Snapshot));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = _shared->sequence.load(std::memory_order_relaxed);
+      } while ((before & 1) || before != after);
+      return res;
+    }
+
+  private:
+    const Shared* _shared = nullptr;
+  };
+
+  /// Create the shared memory. Called by the WM
+  void init();
+
+  /// Remove the shared memory. Called by the WM
+  void cleanup();
+
+  /// Write the current state, if it changed since the last call.
+  void publish();
+
+} // namespace state
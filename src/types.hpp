@@ -4,6 +4,7 @@
 #pragma once
 #include <array>
 #include <optional>
+#include <string>
 
 #include <xcb/randr.h>
 #include "util.hpp"
@@ -167,6 +168,9 @@ struct Client {
   Workspace* workspace;
   int border_width      = 0;
   uint32_t border_color = 0;
+  /* WM_CLASS, read when the window is managed */
+  std::string instance_name;
+  std::string class_name;
 
   operator xcb_window_t() const
   {
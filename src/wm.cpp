@@ -3,20 +3,26 @@
  * full license information. */
 
 #include <algorithm>
+#include <cerrno>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <vector>
-#include <thread>
 
 #include "common.hpp"
 #include "config.hpp"
 #include "ipc/server.hpp"
+#include "loop.hpp"
+#include "state.hpp"
 #include "types.hpp"
 #include "util.hpp"
 #include "wm.hpp"
 #include "xcb.hpp"
 
 #include <err.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -30,7 +36,6 @@ namespace wm {
   bool halt;
   bool should_close;
   int exit_code;
-  std::mutex global_lock;
 
   namespace {
     std::vector<Workspace> _workspaces;
@@ -40,6 +45,8 @@ namespace wm {
     nomove_vector<Client> _bar_list;
     /* Windows to keep on top */
     std::vector<xcb_window_t> _on_top;
+    /* Last window reported to event subscribers as focused */
+    xcb_window_t _notified_focus = XCB_NONE;
 
     /* function handlers for events received from the X server */
     void (*events[xcb::last_xcb_event + 1])(xcb_generic_event_t*);
@@ -81,6 +88,7 @@ namespace wm {
     xcb_set_input_focus(xcb::conn(), XCB_NONE, XCB_INPUT_FOCUS_POINTER_ROOT,
                         XCB_CURRENT_TIME);
     ungrab_buttons();
+    state::cleanup();
     xcb::cleanup();
   }
 
@@ -88,6 +96,7 @@ namespace wm {
   int setup()
   {
     if (auto errc = xcb::init(); errc != 0) return errc;
+    state::init();
 
     xcb::set_number_of_desktops(conf.workspaces);
     // workspaces.reserve(conf.workspaces);
@@ -203,6 +212,11 @@ namespace wm {
     refresh_borders();
 
     if (raise) xcb::raise_window(client);
+
+    if (client.window != _notified_focus) {
+      _notified_focus = client.window;
+      ipc::notify(ipc::Event::Focus, std::to_string(client.window));
+    }
   }
 
   /// Focus last best focus (in a valid workspace, mapped, etc)
@@ -250,7 +264,7 @@ namespace wm {
     client.geom.height =
       ah - static_cast<int>(conf.resize_hints) * (ah % client.height_inc);
 
-    xcb::resize_window_absolute(client, client.geom.width, client.geom.height);
+    xcb::apply_client_geometry(client);
   }
 
   /// Fit window on screen if too big.
@@ -819,7 +833,8 @@ namespace wm {
 
   void workspace_goto(Workspace& workspace)
   {
-    _current_ws = &workspace;
+    bool changed = _current_ws != &workspace;
+    _current_ws  = &workspace;
 
     // TODO: Instead of this, refresh the clients manually
     for (auto& ws : _workspaces) {
@@ -853,6 +868,10 @@ namespace wm {
     xcb::set_current_desktop(current_ws().index);
     update_bar_visibility();
     update_client_list();
+
+    if (changed) {
+      ipc::notify(ipc::Event::Workspace, std::to_string(workspace.index + 1));
+    }
   }
 
   bool show_bar(Workspace& ws)
@@ -1129,6 +1148,7 @@ namespace wm {
 
     if (client != nullptr) {
       free_window(*client);
+      ipc::notify(ipc::Event::Destroy, std::to_string(e->window));
     }
 
     update_client_list();
@@ -1223,6 +1243,7 @@ namespace wm {
         client->should_map = true;
       }
       client->user_set_map = true;
+      ipc::notify(ipc::Event::Map, std::to_string(e->window));
       set_focused(*client);
     }
   }
@@ -1242,6 +1263,7 @@ namespace wm {
     }
 
     client->mapped = false;
+    ipc::notify(ipc::Event::Unmap, std::to_string(e->window));
     if (client->user_set_unmap) {
       DMSG("User set unmap\n");
       client->should_map = false;
@@ -1279,14 +1301,27 @@ namespace wm {
     }
   }
 
-  /// Received client message. ewmh/icccm thing
+  /// Received client message. Either an ewmh/icccm thing, or a command from
+  /// waitron.
   void event_client_message(xcb_generic_event_t* ev)
   {
     auto* e = (xcb_client_message_event_t*) ev;
-    uint32_t ipc_command;
-    uint32_t* data;
     Client* client;
 
+    if (e->type == xcb::ATOMS[xcb::IPC_COMMAND]) {
+      // The request is stored on the window of the sender, which also gets
+      // the response.
+      xcb_window_t sender = e->data.data32[0];
+      auto request =
+        xcb::get_string_property(sender, xcb::ATOMS[xcb::IPC_COMMAND], true);
+      if (!request) return;
+      if (auto response = ipc::handle_message(*request)) {
+        xcb::set_string_property(sender, xcb::ATOMS[xcb::IPC_RESPONSE],
+                                 *response);
+      }
+      return;
+    }
+
     client = find_client(e->window);
     if (client == nullptr) {
       return;
@@ -1603,7 +1638,7 @@ namespace wm {
 
   void usage(char* name)
   {
-    fprintf(stderr, "Usage: %s [-h|-v|-c CONFIG_PATH]\n", name);
+    fprintf(stderr, "Usage: %s [-h|-v|-f|-c CONFIG_PATH]\n", name);
 
     exit(EXIT_SUCCESS);
   }
@@ -1651,9 +1686,19 @@ namespace wm {
     conf.click_to_focus   = CLICK_TO_FOCUS_BUTTON;
   }
 
+  /// Apply the config file. Executable ones are run, and send their settings
+  /// with waitron. Others are read right away, see `ipc::load_config`.
   void load_config(char* config_path)
   {
+    if (access(config_path, X_OK) != 0) {
+      DMSG("reading %s\n", config_path);
+      if (!ipc::load_config(config_path)) {
+        warn("couldn't load config file %s", config_path);
+      }
+      return;
+    }
     if (fork() == 0) {
+      restore_signals();
       setsid();
       DMSG("loading %s\n", config_path);
       execl(config_path, config_path, nullptr);
@@ -1661,35 +1706,98 @@ namespace wm {
     }
   }
 
-  void handle_child(int sig)
-  {
-    if (sig == SIGCHLD) {
-      wait(nullptr);
+  /// Handle the events of the X connection until there are none left.
+  ///
+  /// \param read Whether to read from the socket, or only take the events
+  /// that were read along with replies
+  void handle_events(bool read)
+  {
+    auto next = [read] {
+      return read ? xcb::poll_for_event() : xcb::poll_for_queued_event();
+    };
+    for (auto ev = next(); ev != nullptr; ev = next()) {
+      DMSG("X Event %d\n", ev->response_type & ~0x80);
+      // Before the handler, so a query sent as a client message sees the
+      // events before it
+      ipc::state_changed();
+      if (events[EVENT_MASK(ev->response_type)] != nullptr) {
+        (events[EVENT_MASK(ev->response_type)])(ev.get());
+      }
+    }
+    if (xcb_connection_has_error(xcb::conn()) != 0) {
+      errx(EXIT_FAILURE, "lost the connection to X");
+    }
+    if (should_close) {
+      if (std::none_of(std::begin(_workspaces), std::end(_workspaces),
+                       [](auto& ws) { return ws.windows.size() > 0; })) {
+        halt = true;
+      }
     }
   }
 
-  /// Wait for events and handle them.
+  /// Signals handled by the loop, instead of interrupting it
+  static sigset_t _signals;
+  /// The mask to give back to children
+  static sigset_t _old_signals;
+
+  void block_signals()
+  {
+    sigemptyset(&_signals);
+    sigaddset(&_signals, SIGCHLD);
+    sigaddset(&_signals, SIGINT);
+    sigaddset(&_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &_signals, &_old_signals);
+  }
+
+  void restore_signals()
+  {
+    sigprocmask(SIG_SETMASK, &_old_signals, nullptr);
+  }
+
+  /// Watch the blocked signals with a signalfd. Children are reaped, and
+  /// SIGINT or SIGTERM stop the loop, so the endpoint and the state are
+  /// cleaned up on the way out.
+  static void watch_signals()
+  {
+    int fd = signalfd(-1, &_signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (fd < 0) errx(EXIT_FAILURE, "error creating signalfd");
+    loop::add(fd, EPOLLIN, [fd](std::uint32_t) {
+      signalfd_siginfo info;
+      while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGCHLD) {
+          // Signals of children that exit together are merged into one
+          while (waitpid(-1, nullptr, WNOHANG) > 0) {}
+        } else {
+          exit_code = static_cast<int>(info.ssi_signo);
+          halt      = true;
+        }
+      }
+    });
+  }
+
+  /// Wait for X events, requests, timers and signals, and handle them.
+  ///
+  /// Everything runs on this thread, in the order it is seen. Each wakeup
+  /// handles all that is ready, runs the requests read, then flushes the X
+  /// connection once, before responses go out.
   void run()
   {
     halt         = false;
     should_close = false;
     exit_code    = EXIT_SUCCESS;
-    while (!halt) {
+    watch_signals();
+    loop::add(xcb_get_file_descriptor(xcb::conn()), EPOLLIN,
+              [](std::uint32_t) { handle_events(true); });
+    while (true) {
+      // Replies read while handling requests can bring events along, which
+      // epoll doesn't see
+      handle_events(false);
+      state::publish();
       xcb::flush();
-      auto ev = xcb::wait_for_event();
-      std::unique_lock lock (global_lock);
-      if (should_close) {
-        if (std::none_of(std::begin(_workspaces), std::end(_workspaces),
-                         [](auto& ws) { return ws.windows.size() > 0; })) {
-          halt = true;
-        }
-      }
-      if (ev != nullptr) {
-        DMSG("X Event %d\n", ev->response_type & ~0x80);
-        if (events[EVENT_MASK(ev->response_type)] != nullptr) {
-          (events[EVENT_MASK(ev->response_type)])(ev.get());
-        }
-      }
+      auto timeout = ipc::send_responses();
+      if (halt) break;
+      loop::wait(timeout);
+      ipc::run_requests();
     }
   }
 
@@ -1701,15 +1809,21 @@ using namespace wm;
 int main(int argc, char* argv[])
 {
   int opt;
+  auto transport    = ipc::Transport::Socket;
   auto* config_path = (char*) malloc(MAXLEN * sizeof(char));
   config_path[0]    = '\0';
-  while ((opt = getopt(argc, argv, "hvc:")) != -1) {
+  while ((opt = getopt(argc, argv, "hvfc:")) != -1) {
     switch (opt) {
     case 'h': usage(argv[0]); break;
     case 'c': snprintf(config_path, MAXLEN * sizeof(char), "%s", optarg); break;
+    case 'f': transport = ipc::Transport::Fifo; break;
     case 'v': version(); break;
     }
   }
+  /* before any thread starts, so signals only reach the signalfd */
+  block_signals();
+  /* before cleanup, so messages logged during cleanup are written out */
+  logging::start();
   atexit(cleanup);
 
   register_event_handlers();
@@ -1730,15 +1844,14 @@ int main(int argc, char* argv[])
     }
   }
 
-  signal(SIGCHLD, handle_child);
+  loop::init();
+  ipc::start(transport);
 
   /* execute config file */
   load_config(config_path);
-  auto ipc_thread = std::thread{ipc::run};
   run();
 
-  ipc::exit();
-  ipc_thread.join();
+  ipc::stop();
 
   free(config_path);
 
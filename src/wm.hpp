@@ -1,6 +1,5 @@
 #pragma once
 #include <optional>
-#include <mutex>
 
 #include <xcb/xcb_ewmh.h>
 #include "types.hpp"
@@ -13,8 +12,6 @@ namespace wm {
   extern bool halt;
   extern bool should_close;
   extern int exit_code;
-  /// Synchronize between the IPC loop and the X loop
-  extern std::mutex global_lock;
 
   std::vector<Workspace>& workspaces() noexcept;
   std::vector<xcb_window_t>& on_top() noexcept;
@@ -108,5 +105,9 @@ namespace wm {
   void version();
   void load_defaults();
   void load_config(char* config_path);
+  /// Block the signals that are handled by the loop, see `run`
+  void block_signals();
+  /// Unblock them again, in a child that is about to exec
+  void restore_signals();
 
 } // namespace wm
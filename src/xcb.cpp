@@ -1,6 +1,8 @@
 #include "xcb.hpp"
 
+#include <algorithm>
 #include <array>
+#include <vector>
 
 #include "common.hpp"
 #include "wm.hpp"
@@ -38,8 +40,52 @@ namespace xcb {
 
     /* function handlers for events received from the X server */
     void (*events[xcb::last_xcb_event + 1])(xcb_generic_event_t*);
+
+    /* number of alive FlushBatch objects, and whether a flush was held back */
+    int flush_batches    = 0;
+    bool flush_held_back = false;
+
+    /* number of alive ConfigureBatch objects, and the clients they deferred */
+    int configure_batches = 0;
+    std::vector<Client*> deferred_geometry;
+    std::vector<Client*> deferred_borders;
+
+    void defer(std::vector<Client*>& list, Client& client)
+    {
+      if (std::find(list.begin(), list.end(), &client) == list.end()) {
+        list.push_back(&client);
+      }
+    }
+
+    void send_client_geometry(Client& cl)
+    {
+      uint32_t values[4] = {(uint32_t) cl.geom.x, (uint32_t) cl.geom.y,
+                            (uint32_t) cl.geom.width,
+                            (uint32_t) cl.geom.height};
+      uint32_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                      XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+      xcb_configure_window(_conn, cl.window, mask, values);
+    }
+
+    void send_borders(Client& client)
+    {
+      uint32_t values[1];
+      values[0] = client.border_width;
+      xcb_configure_window(_conn, client.window,
+                           XCB_CONFIG_WINDOW_BORDER_WIDTH, values);
+      if (client.border_width > 0) {
+        values[0] = client.border_color;
+        xcb_change_window_attributes(_conn, client.window, XCB_CW_BORDER_PIXEL,
+                                     values);
+      }
+    }
   } // namespace
 
+  std::vector<Monitor>& monitors() noexcept
+  {
+    return mon_list;
+  }
+
   /// Get a pointer to the current xcb connection.
   ///
   /// This exists between `init` and `cleanup`
@@ -176,7 +222,7 @@ namespace xcb {
     pointer_init();
 
     /* send requests */
-    xcb_flush(_conn);
+    flush();
 
     randr_base = setup_randr();
     return 0;
@@ -438,31 +484,25 @@ namespace xcb {
       return;
     }
 
-    uint32_t values[2] = {(uint32_t) cl.geom.x, (uint32_t) cl.geom.y};
-    uint32_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
-    xcb_configure_window(_conn, cl.window, mask, values);
-
-    uint32_t values2[2] = {(uint32_t) cl.geom.width, (uint32_t) cl.geom.height};
-    mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
-    xcb_configure_window(_conn, cl.window, mask, values2);
+    if (configure_batches > 0) {
+      defer(deferred_geometry, cl);
+      return;
+    }
+    send_client_geometry(cl);
 
-    xcb_flush(_conn);
+    flush();
   }
 
   /// Apply client.border_color and border_width.
   void apply_borders(Client& client)
   {
-    uint32_t values[1];
-    values[0] = client.border_width;
-    xcb_configure_window(_conn, client.window, XCB_CONFIG_WINDOW_BORDER_WIDTH,
-                         values);
-    if (client.border_width > 0) {
-      values[0] = client.border_color;
-      xcb_change_window_attributes(_conn, client.window, XCB_CW_BORDER_PIXEL,
-                                   values);
+    if (configure_batches > 0) {
+      defer(deferred_borders, client);
+      return;
     }
+    send_borders(client);
 
-    xcb_flush(_conn);
+    flush();
   }
 
 
@@ -545,7 +585,7 @@ namespace xcb {
     xcb_configure_window(_conn, win, XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y,
                          values);
 
-    xcb_flush(_conn);
+    flush();
   }
 
   /// Moves the window by a certain amount.
@@ -764,6 +804,14 @@ namespace xcb {
 
     cl.geom = get_geometry(cl).value_or(Geometry{});
 
+    xcb_icccm_get_wm_class_reply_t wm_class;
+    if (xcb_icccm_get_wm_class_reply(_conn, xcb_icccm_get_wm_class(_conn, win),
+                                     &wm_class, nullptr) == 1) {
+      cl.instance_name = wm_class.instance_name;
+      cl.class_name    = wm_class.class_name;
+      xcb_icccm_get_wm_class_reply_wipe(&wm_class);
+    }
+
     xcb_icccm_get_wm_normal_hints_reply(
       _conn, xcb_icccm_get_wm_normal_hints_unchecked(_conn, win), &hints,
       nullptr);
@@ -821,7 +869,7 @@ namespace xcb {
   void set_number_of_desktops(int n)
   {
     xcb_ewmh_set_number_of_desktops(ewmh, 0, n);
-    xcb_flush(_conn);
+    flush();
   }
 
   /// Set ewmh current desktop
@@ -888,18 +936,59 @@ namespace xcb {
     return res;
   }
 
+  /// Get the top level window under the mouse pointer, or `XCB_NONE`
+  xcb_window_t get_window_under_pointer() noexcept
+  {
+    auto* pointer = xcb_query_pointer_reply(
+      _conn, xcb_query_pointer(_conn, scr->root), nullptr);
+
+    if (pointer == nullptr) return XCB_NONE;
+    auto res = pointer->child;
+
+    free(pointer);
+    return res;
+  }
+
   /// Set the mouse pointer's position relative to `win`
   void warp_pointer(xcb_window_t win, Coordinates location) noexcept
   {
     xcb_warp_pointer(_conn, XCB_NONE, win, 0, 0, 0, 0, location.x, location.y);
   }
 
-  /// Wait for an xcb event
-  unique_ptr<xcb_generic_event_t> wait_for_event(bool handle) noexcept
+  /// Get a string property of a window.
+  std::optional<std::string> get_string_property(xcb_window_t win,
+                                                 xcb_atom_t atom,
+                                                 bool del) noexcept
   {
-    auto ev = unique_ptr<xcb_generic_event_t>(xcb_wait_for_event(_conn));
-    if (ev == nullptr || !handle) return ev;
+    // Properties are read in 4 byte units. 64KiB is plenty for any response
+    auto* reply = xcb_get_property_reply(
+      _conn,
+      xcb_get_property(_conn, del, win, atom, XCB_ATOM_STRING, 0, 1 << 14),
+      nullptr);
+    if (reply == nullptr) return std::nullopt;
+    if (reply->type == XCB_NONE) {
+      free(reply);
+      return std::nullopt;
+    }
+    auto* data = static_cast<char*>(xcb_get_property_value(reply));
+    std::string res(data, xcb_get_property_value_length(reply));
+    free(reply);
+    return res;
+  }
 
+  /// Set a string property of a window.
+  void set_string_property(xcb_window_t win,
+                           xcb_atom_t atom,
+                           std::string const& value) noexcept
+  {
+    xcb_change_property(_conn, XCB_PROP_MODE_REPLACE, win, atom,
+                        XCB_ATOM_STRING, 8, value.size(), value.data());
+  }
+
+  /// Run the internal event handlers
+  static unique_ptr<xcb_generic_event_t> handle_event(
+    unique_ptr<xcb_generic_event_t> ev) noexcept
+  {
     if (ev->response_type == randr_base + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
       get_randr();
       DMSG("Screen layout changed\n");
@@ -913,12 +1002,70 @@ namespace xcb {
     return ev;
   }
 
+  /// Wait for an xcb event
+  unique_ptr<xcb_generic_event_t> wait_for_event(bool handle) noexcept
+  {
+    auto ev = unique_ptr<xcb_generic_event_t>(xcb_wait_for_event(_conn));
+    if (ev == nullptr || !handle) return ev;
+    return handle_event(std::move(ev));
+  }
+
+  /// Get an event without blocking
+  unique_ptr<xcb_generic_event_t> poll_for_event(bool handle) noexcept
+  {
+    auto ev = unique_ptr<xcb_generic_event_t>(xcb_poll_for_event(_conn));
+    if (ev == nullptr || !handle) return ev;
+    return handle_event(std::move(ev));
+  }
+
+  /// Get an event that has already been read from the connection
+  unique_ptr<xcb_generic_event_t> poll_for_queued_event(bool handle) noexcept
+  {
+    auto ev =
+      unique_ptr<xcb_generic_event_t>(xcb_poll_for_queued_event(_conn));
+    if (ev == nullptr || !handle) return ev;
+    return handle_event(std::move(ev));
+  }
+
   /// Flush the xcb connection
   void flush() noexcept
   {
+    if (flush_batches > 0) {
+      flush_held_back = true;
+      return;
+    }
     xcb_flush(_conn);
   }
 
+  FlushBatch::FlushBatch() noexcept
+  {
+    flush_batches++;
+  }
+
+  FlushBatch::~FlushBatch() noexcept
+  {
+    if (--flush_batches == 0 && flush_held_back) {
+      flush_held_back = false;
+      xcb_flush(_conn);
+    }
+  }
+
+  ConfigureBatch::ConfigureBatch() noexcept
+  {
+    configure_batches++;
+  }
+
+  ConfigureBatch::~ConfigureBatch() noexcept
+  {
+    if (--configure_batches > 0) return;
+    for (auto* client : deferred_geometry) send_client_geometry(*client);
+    for (auto* client : deferred_borders) send_borders(*client);
+    if (!deferred_geometry.empty() || !deferred_borders.empty()) flush();
+    deferred_geometry.clear();
+    deferred_borders.clear();
+    // `_flush` sends everything when it is destroyed, right after this
+  }
+
   /// Window has been configured.
   static void event_configure_notify(xcb_generic_event_t* ev)
   {
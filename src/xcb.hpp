@@ -1,7 +1,9 @@
 #pragma once
 
 #include <optional>
+#include <string>
 
+#include "common.hpp"
 #include "types.hpp"
 
 #define EVENT_MASK(ev) (((ev) & ~0x80))
@@ -21,10 +23,12 @@ namespace xcb {
   constexpr const unsigned last_xcb_event = XCB_GET_MODIFIER_MAPPING;
 
   /* atoms identifiers */
-  enum { WM_DELETE_WINDOW, NR_ATOMS };
+  enum { WM_DELETE_WINDOW, IPC_COMMAND, IPC_RESPONSE, NR_ATOMS };
 
   constexpr const char* atom_names[NR_ATOMS] = {
-    "WM_DELETE_WINDOW"
+    "WM_DELETE_WINDOW",
+    IPC_COMMAND_ATOM,
+    IPC_RESPONSE_ATOM,
   };
 
   extern xcb_atom_t ATOMS[NR_ATOMS];
@@ -64,6 +68,9 @@ namespace xcb {
                    int len,
                    xcb_timestamp_t timestamp);
 
+  /// The monitor list
+  std::vector<Monitor>& monitors() noexcept;
+
   /// Finds a monitor in the list.
   Monitor* find_monitor(xcb_randr_output_t mon);
 
@@ -88,7 +95,8 @@ namespace xcb {
   /// Get atom by name.
   xcb_atom_t get_atom(const char* name);
 
-  /// Move and resize the client to its set geometry
+  /// Move and resize the client to its set geometry, or mark it to be, if a
+  /// `ConfigureBatch` is alive
   void apply_client_geometry(Client& cl);
 
   /// Put window at the top of the window stack.
@@ -142,7 +150,8 @@ namespace xcb {
   /// found
   Client make_client(xcb_window_t win, bool require_type);
 
-  /// Apply client.border_width and client.border_color
+  /// Apply client.border_width and client.border_color, or mark it to be, if
+  /// a `ConfigureBatch` is alive
   void apply_borders(Client& client);
 
   /// Returns true if window is mapped.
@@ -172,17 +181,70 @@ namespace xcb {
   /// Get the mouse pointer's coordinates relative to `win`
   std::optional<Coordinates> get_pointer_location(xcb_window_t win) noexcept;
 
+  /// Get the top level window under the mouse pointer, or `XCB_NONE`
+  xcb_window_t get_window_under_pointer() noexcept;
+
   /// Set the mouse pointer's position relative to `win`
   void warp_pointer(xcb_window_t win, Coordinates location) noexcept;
 
+  /// Get a string property of a window.
+  ///
+  /// \param del Delete the property after reading it
+  std::optional<std::string> get_string_property(xcb_window_t win,
+                                                 xcb_atom_t atom,
+                                                 bool del = false) noexcept;
+
+  /// Set a string property of a window.
+  void set_string_property(xcb_window_t win,
+                           xcb_atom_t atom,
+                           std::string const& value) noexcept;
+
   /// Wait for an xcb event
   /// 
   /// \param handle Whether to run internal event handlers before returning
   unique_ptr<xcb_generic_event_t> wait_for_event(bool handle = true) noexcept;
 
-  /// Flush the xcb connection
+  /// Get an event without blocking, reading from the socket if none has
+  /// been read yet.
+  ///
+  /// \param handle Whether to run internal event handlers before returning
+  unique_ptr<xcb_generic_event_t> poll_for_event(bool handle = true) noexcept;
+
+  /// Get an event that has already been read from the connection, without
+  /// blocking or reading from the socket.
+  ///
+  /// \param handle Whether to run internal event handlers before returning
+  unique_ptr<xcb_generic_event_t> poll_for_queued_event(
+    bool handle = true) noexcept;
+
+  /// Flush the xcb connection, unless a `FlushBatch` is alive
   void flush() noexcept;
 
+  /// Hold back flushes while alive, and flush once when the outermost batch
+  /// ends, if any flush was held back.
+  struct FlushBatch {
+    FlushBatch() noexcept;
+    ~FlushBatch() noexcept;
+    FlushBatch(FlushBatch const&) = delete;
+    FlushBatch& operator=(FlushBatch const&) = delete;
+  };
+
+  /// Defer `apply_client_geometry` and `apply_borders` while alive. When the
+  /// outermost batch ends, each marked client gets one request for its final
+  /// geometry and one for its borders, followed by a single flush.
+  ///
+  /// No client may be freed while a batch is alive. Code in between must not
+  /// read back the geometry of windows from the X server.
+  struct ConfigureBatch {
+    ConfigureBatch() noexcept;
+    ~ConfigureBatch() noexcept;
+    ConfigureBatch(ConfigureBatch const&) = delete;
+    ConfigureBatch& operator=(ConfigureBatch const&) = delete;
+
+  private:
+    FlushBatch _flush;
+  };
+
   /// Received client message. Either ewmh/icccm thing or
   /// message from the client.
   void handle_client_message(Client& client, xcb_client_message_event_t* ev) noexcept;